@@ -26,6 +26,7 @@ static float score_hp             = -16.0;   /* Score of a high priority match*/
 static float score_file           = 8.0;     /* Score of a match which is a file */
 static float score_folder         = 8.0;     /* Score of a match which is a folder*/
 static float score_path           = -1024.0; /* Score of a file or folder when completing path */
+static float score_frecency       = -256.0;  /* Score of a recent selection (-H), grows with their log */
 
 static const char hpchar = '*';
 static int topbar = 1;                      /* -b option; if 0, dmenu appears at bottom */
@@ -33,6 +34,9 @@ static int centered = 1;                    /* -c option; centers dmenu on scree
 static int min_width = 500;                 /* minimum width when centered */
 static int fuzzy = 1;                       /* -F option; if 0, dmenu doesn't use fuzzy matching, file completion is only available in fuzzy */
 static int casesensitive = 0;               /* Whether to be case-sensitive or not */
+static int prefixindex = 0;                 /* -F: sorts the items once, exact matches and prefixes are then found by binary search; no faster than the scan up to 1M items */
+static int snapshot = 0;                    /* -snapshot option; maps the items and widths of the last start with the same input */
+static int imagedraw = 0;                   /* -image option; composes frames client side and sends the pixels that changed */
 static unsigned int alpha = 0xff * 0.7;     /* Amount of opacity. 0xff is opaque */
 /* -fn option overrides fonts[0]; default X11 font or font set */
 static const char *fonts[] = {
@@ -12,8 +12,11 @@ X11LIB = /usr/X11R6/lib
 XINERAMALIBS  = -lXinerama
 XINERAMAFLAGS = -DXINERAMA
 
+# io_uring batched stat in stest (Linux 5.6), comment if you don't want it
+URINGFLAGS = -DIOURING
+
 # freetype
-FREETYPELIBS = -lfontconfig -lXft
+FREETYPELIBS = -lfontconfig -lXft -lfreetype
 FREETYPEINC = /usr/include/freetype2
 # OpenBSD (uncomment)
 #FREETYPEINC = $(X11INC)/freetype2
@@ -21,12 +24,19 @@ FREETYPEINC = /usr/include/freetype2
 
 # includes and libs
 INCS = -I$(X11INC) -I$(FREETYPEINC)
-LIBS = -L$(X11LIB) -lX11 $(XINERAMALIBS) $(FREETYPELIBS) -lXrender -lm
+LIBS = -L$(X11LIB) -lX11 -lXext $(XINERAMALIBS) $(FREETYPELIBS) -lXrender -lm -lpthread
 
 # flags
 # DEBUGFLAGS = -O0 -g -fsanitize=address -fno-omit-frame-pointer
-CFLAGS = -std=c99 -D_POSIX_C_SOURCE=200809 -pedantic -Wall -DVERSION=\"$(VERSION)\" $(XINERAMAFLAGS) -O4 $(INCS) $(DEBUGFLAGS) 
+CFLAGS = -std=c99 -D_POSIX_C_SOURCE=200809 -pedantic -Wall -DVERSION=\"$(VERSION)\" $(XINERAMAFLAGS) $(URINGFLAGS) -O4 $(INCS) $(DEBUGFLAGS) 
 LDFLAGS = $(LIBS) $(DEBUGFLAGS)
 
+# make bench: lines of each generated corpus, malloc is wrapped (GNU ld)
+BENCHSIZES = 1000 100000 1000000 10000000
+BENCHLDFLAGS = -lpthread -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+
+# make latency: needs Xvfb and the XTest and Damage libraries
+LATENCYLIBS = -lXtst -lXdamage
+
 # compiler and linker
 CC = cc
@@ -1,8 +1,18 @@
 /* See LICENSE file for copyright and license details. */
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#define __USE_GNU
+#include <spawn.h>
+#undef __USE_GNU
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +23,16 @@
 #define __USE_MISC
 #include <dirent.h>
 #undef __USE_MISC
+#include <sys/mman.h>
+#define __USE_GNU
+#define __USE_MISC
+#include <sys/socket.h>
+#undef __USE_MISC
+#undef __USE_GNU
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <pwd.h>
 
 #include <X11/Xlib.h>
@@ -27,6 +46,13 @@
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
+#include "frecency.h"
+#include "match.h"
+#include "path.h"
+#include "snap.h"
+#include "stats.h"
+#include "timing.h"
+#include "trace.h"
 #include "util.h"
 
 /* macros */
@@ -36,21 +62,35 @@
 #define TEXTW(X)              (drw_fontset_getwidth(drw, (X)) + lrpad)
 #define NUMBERSMAXDIGITS      100
 #define NUMBERSBUFSIZE        (NUMBERSMAXDIGITS * 2) + 1
+#define MEASUREMS             20 /* max_textw() measures the rest for this long */
+#define CLIENTTIMEOUT         5  /* s the daemon waits on a client gone quiet */
 
 #define OPAQUE                0xffu
 
+/* -x starts commands in a session of their own where the libc can */
+#ifdef POSIX_SPAWN_SETSID
+#define SPAWNFLAGS            POSIX_SPAWN_SETSID
+#else
+#define SPAWNFLAGS            POSIX_SPAWN_SETPGROUP
+#endif
+/* and in $HOME, changed to by the child where the libc can, by the "cd" of
+ * CMDFORMAT otherwise */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29)
+#define SPAWNCHDIR
+#endif
+
 /* enums */
 enum { SchemeNorm, SchemeSel, SchemeNormHighlight, SchemeSelHighlight,
        SchemeLast }; /* color schemes */
 
-struct item {
-	char *text;
-	unsigned int len;
-	struct item *left, *right;
-	double distance;
-	unsigned char hp : 1;
-	unsigned char file : 1;
-	unsigned char folder : 1;
+/* item list kept loaded by the daemon, see -corpus */
+struct corpus {
+	char *path;
+	time_t mtime;
+	struct item *items;
+	size_t n;
+	int maxw;
+	struct corpus *next;
 };
 
 static char numbers[NUMBERSBUFSIZE] = "";
@@ -63,14 +103,43 @@ static int ctrlpressed = 0;
 static int filesiz = 0;
 static size_t cursor;
 static struct item *items = NULL;
+static MatchIndex pindex; /* of items, with prefixindex */
 static struct item *files = NULL;
 static struct item *matches, *matchend;
 static struct item *prev, *curr, *next, *sel;
 static int mon = -1, screen;
+static int itemsw = -1; /* cached max_textw() of items */
+static int itemswguess = 0; /* it holds guessed widths */
+static int fast = 0;
+static int clientmode = 0, daemonmode = 0;
+static int status = 1; /* of the menu the daemon shows, sent to the client */
+static const char *corpus = NULL;
+static const char *histfile = NULL; /* -H: frecency of the selections */
+static struct corpus *corpora = NULL;
+/* -path: the items point into the mapped dmenu_path cache */
+static int pathmode = 0;
+static int execmode = 0; /* -x: run the selection instead of printing it */
+static char *pathmap = NULL;
+static size_t pathmaplen = 0;
+static int pathrefresh = 0; /* a background scan is running */
+static int pathfresh = 0;   /* it rewrote the cache, swap at the next match() */
+static pthread_mutex_t pathlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pathwrite = PTHREAD_MUTEX_INITIALIZER; /* held while a scan writes a tmp file */
+/* -snapshot: the items and widths of the last start with the same input */
+static Snap snap;
+static uint64_t snapkey;
+static int snapdirty = 0;
+static char *inbuf = NULL; /* the input the items point into */
+static int running = 1;
+static int exposed = 0; /* first Expose of the menu was timed */
+static unsigned int roundtrips = 0; /* blocking requests before the first frame */
+static FILE *out;
+static char fontcache[PATH_MAX]; /* fallback fonts found by earlier runs */
 
 static Atom clip, utf8;
 static Display *dpy;
 static Window root, parentwin, win;
+static XIM xim;
 static XIC xic;
 
 static Drw *drw;
@@ -83,11 +152,14 @@ static Colormap cmap;
 
 #include "config.h"
 
-static int (*fstrncmp)(const char *, const char *, size_t);
-static char *(*fstrstr)(const char *, const char *);
+extern char **environ;
+
+static MatchConf matchconf;
 
+static int parseargs(int argc, char *argv[], int served);
 static void xinitvisual();
 
+
 static unsigned int textw_clamp(const char *str, unsigned int n) {
 	unsigned int w = drw_fontset_getwidth_clamp(drw, str, n) + lrpad;
 	return MIN(w, n);
@@ -114,6 +186,7 @@ static void readfolder(const char *path) {
 		filesiz = 16;
 		if (!(files = malloc(filesiz * sizeof(*files))))
 			die("cannot realloc %zu bytes:", filesiz * sizeof(*files));
+		stats_count(StatAlloc, filesiz * sizeof(*files));
 	}
 	while ((ent = readdir(dir))) {
 		if (ent->d_name[0] == '\0') continue;
@@ -127,17 +200,22 @@ static void readfolder(const char *path) {
 			filesiz += 16;
 			if (!(files = realloc(files, filesiz * sizeof(*files))))
 				die("cannot realloc %zu bytes:", filesiz * sizeof(*files));
+			stats_count(StatAlloc, filesiz * sizeof(*files));
 		}
 		it = files + i;
 		it->len = strlen(ent->d_name);
 		if (!(it->text = malloc(it->len + 1))) die("malloc");
+		stats_count(StatAlloc, it->len + 1);
 		memcpy(it->text, ent->d_name, it->len + 1);
 		it->left = NULL;
 		it->right = NULL;
 		it->distance = 0;
+		it->bonus = 0;
+		it->w = 0;
 		it->hp = 0;
 		it->file = 1;
 		it->folder = ent->d_type == DT_DIR;
+		it->sig = match_signature(it->text);
 		i += 1;
 	}
 	it = files + i;
@@ -146,15 +224,6 @@ static void readfolder(const char *path) {
 	closedir(dir);
 }
 
-static void appenditem(struct item *item, struct item **list, struct item **last) {
-	if (*last)
-		(*last)->right = item;
-	else
-		*list = item;
-	item->left = *last;
-	item->right = NULL;
-	*last = item;
-}
 
 static void calcoffsets(void) {
 	int i, n;
@@ -171,11 +240,59 @@ static void calcoffsets(void) {
 			break;
 }
 
+/* The width of the widest item, to size a centered menu. Printable ASCII is
+ * added up from the advances of the font; anything else is measured for
+ * MEASUREMS and then guessed from the widest advance, so a long list does not
+ * keep the window from mapping. Only exact widths are kept in the items. */
 static int max_textw(void) {
-	int len = 0;
-	for (struct item *item = items; item && item->text; item++)
-		len = MAX(TEXTW(item->text), len);
-	return len;
+	double t, end;
+	const char *s;
+	int w, n, guessed = 0;
+
+	if (itemsw >= 0)
+		return itemsw;
+	t = timing_now();
+	end = t + MEASUREMS;
+	itemsw = 0;
+	for (struct item *item = items; item && item->text; item++) {
+		if (!(w = item->w)) {
+			if ((w = drw_fontset_getwidth_ascii(drw, item->text)) >= 0) {
+				w = item->w = w + lrpad;
+			} else if (timing_now() < end) {
+				w = item->w = TEXTW(item->text);
+			} else {
+				for (s = item->text, n = 0; *s; s++)
+					n += (*s & 0xc0) != 0x80;
+				w = n * drw->fonts->xfont->max_advance_width + lrpad;
+				guessed++;
+			}
+		}
+		itemsw = MAX(w, itemsw);
+	}
+	itemswguess = guessed > 0;
+	snapdirty = snapshot;
+	timing_phase("max_textw", t);
+	timing_value("max_textw_guessed", guessed);
+	return itemsw;
+}
+
+static void freeitems(struct item *list) {
+	if (list == pindex.list)
+		match_index_free(&pindex);
+	for (struct item *it = list; it && it->text; ++it)
+		free(it->text);
+	free(list);
+}
+
+static void freepath(void) {
+	if (pathmap)
+		munmap(pathmap, pathmaplen);
+	pathmap = NULL;
+	pathmaplen = 0;
+	if (items == pindex.list)
+		match_index_free(&pindex);
+	free(items);
+	items = NULL;
 }
 
 static void cleanup(void) {
@@ -183,9 +300,15 @@ static void cleanup(void) {
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
 	for (i = 0; i < SchemeLast; i++)
 		free(scheme[i]);
-	for (i = 0; items && items[i].text; ++i)
-		free(items[i].text);
-	free(items);
+	if (pathmode) {
+		freepath();
+	} else if (snapshot) {
+		free(items);
+		free(inbuf);
+	} else {
+		freeitems(items);
+	}
+	snap_free(&snap);
 	if (files) {
 		for (struct item *it = files; it && it->text; ++it)
 			free(it->text);
@@ -196,46 +319,64 @@ static void cleanup(void) {
 	XCloseDisplay(dpy);
 }
 
-static char *cistrstr(const char *h, const char *n) {
-	size_t i;
-	if (!n[0]) return (char *)h;
-	for (/* empty */; *h; ++h) {
-		for (i = 0; n[i] && tolower((unsigned char)n[i]) == tolower((unsigned char)h[i]); ++i) {}
-		if (n[i] == '\0')
-			return (char *)h;
+/* finish the current menu: the daemon keeps running, anything else exits */
+static void quit(int ret) {
+	stats_dump();
+	trace_dump();
+	/* a cache, failing to write it (like under pledge) only costs time */
+	if (*fontcache)
+		drw_fallback_save(drw, fontcache);
+	if (!daemonmode) {
+		/* a background scan may be writing the cache: let it rename or
+		 * unlink its tmp file, then exit holding the lock so it cannot
+		 * start another */
+		pthread_mutex_lock(&pathwrite);
+		cleanup();
+		exit(ret);
 	}
-	return NULL;
+	status = ret;
+	running = 0;
 }
 
+
+/* the item in runs of highlighted and plain bytes, as the matcher placed
+ * them, cut off with an ellipsis where w runs out */
 static int drawitem(struct item *item, char *search, int x, int y, int w) {
-	char *itemtext = item->text;
-	char *inputtext = search;
-	char temp[2] = " ";
+	static unsigned char *mask;
+	static size_t masksiz;
+	char run[256];
+	const char *s = item->text;
 	int ellipsis_w = TEXTW("…") - lrpad;
-	int tw = TEXTW(itemtext) - lrpad;
+	int tw = (item->w ? item->w : TEXTW(s)) - lrpad;
+	size_t i, n;
+
+	if (item->len + 1 > masksiz) {
+		masksiz = item->len + 1;
+		if (!(mask = realloc(mask, masksiz)))
+			die("cannot realloc %zu bytes:", masksiz);
+	}
+	match_positions(&matchconf, fuzzy, search, s, mask);
 	drw_setscheme(drw, scheme[item == sel ? SchemeSel : SchemeNorm]);
 	drw_rect(drw, x, y, w, bh, 1, 1);
 	x += lrpad / 2;
 	w -= lrpad;
 	if (tw + ellipsis_w < w)
 		x += w / 2 - tw / 2;
-	for (/* empty */; *itemtext != '\0'; ++itemtext) {
-		temp[0] = itemtext[0];
-		tw = TEXTW(temp) - lrpad;
-		if (tw + ellipsis_w > w) {
-			drw_setscheme(drw, scheme[item == sel ? SchemeSel : SchemeNorm]);
-			x = drw_text(drw, x, y, ellipsis_w, bh, 0, "…", 0);
-			break;
-		} else {
-			if (*inputtext != '\0' && fstrncmp(itemtext, inputtext, 1) == 0) {
-				drw_setscheme(drw, scheme[item == sel ? SchemeSelHighlight : SchemeNormHighlight]);
-				inputtext += 1;
-			} else {
-				drw_setscheme(drw, scheme[item == sel ? SchemeSel : SchemeNorm]);
-			}
-			x = drw_text(drw, x, y, tw, bh, 0, temp, 0);
-			w -= tw;
-		}
+	for (i = 0; s[i] && w > 0; i += n) {
+		/* never split a UTF-8 sequence: its continuation bytes may go
+		 * past the cap into the 4 bytes kept for them */
+		for (n = 1; s[i + n] && (n < sizeof(run) - 4 ||
+		     ((s[i + n] & 0xc0) == 0x80 && n < sizeof(run) - 1)) &&
+		     (mask[i + n] == mask[i] || (s[i + n] & 0xc0) == 0x80); n++)
+			;
+		memcpy(run, s + i, n);
+		run[n] = '\0';
+		tw = TEXTW(run) - lrpad;
+		drw_setscheme(drw, scheme[mask[i] ? (item == sel ? SchemeSelHighlight : SchemeNormHighlight)
+		                                   : (item == sel ? SchemeSel : SchemeNorm)]);
+		/* drw_text() puts the ellipsis itself when the run overflows */
+		x = drw_text(drw, x, y, MIN(tw, w), bh, 0, run, 0);
+		w -= tw;
 	}
 	return x;
 }
@@ -257,6 +398,7 @@ static void drawmenu(void) {
 	unsigned int curpos;
 	struct item *item;
 	int x = 0, y = 0, w, tw;
+	double t = stats_start(), tr = trace_begin();
 
 	drw_setscheme(drw, scheme[SchemeNorm]);
 	drw_rect(drw, 0, 0, mw, mh, 1, 1);
@@ -288,7 +430,7 @@ static void drawmenu(void) {
 	}
 	// TODO put all of this into configs
 	char *search = text;
-	if (1) {
+	if (fuzzy) {
 		char *lastword = search;
 		for (/* empty */; *search; ++search) {
 			if (*search == ' ') lastword = search + 1;
@@ -333,100 +475,88 @@ static void drawmenu(void) {
 		}
 	}
 	drw_map(drw, win, 0, 0, mw, mh);
+	stats_time(StatDrawmenu, t);
+	trace_end("drawmenu", tr);
+}
+
+/* wait up to ms milliseconds for the X server to send something */
+static void waitevent(int ms) {
+	struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+
+	if (!XPending(dpy))
+		poll(&pfd, 1, ms);
 }
 
 static void grabfocus(void) {
-	struct timespec ts = { .tv_sec = 0, .tv_nsec = 10000000  };
 	Window focuswin;
-	int i, revertwin;
+	XEvent ev;
+	int revertwin, wait = 1;
+	double t = timing_now();
 
-	for (i = 0; i < 100; ++i) {
+	for (;;) {
 		XGetInputFocus(dpy, &focuswin, &revertwin);
+		roundtrips++;
 		if (focuswin == win)
-			return;
+			break;
+		if (timing_now() - t > 1000)
+			die("cannot grab focus");
 		XSetInputFocus(dpy, win, RevertToParent, CurrentTime);
-		nanosleep(&ts, NULL);
+		/* check again as soon as the FocusIn arrives, back off if it does not */
+		waitevent(wait);
+		if (XCheckTypedWindowEvent(dpy, win, FocusIn, &ev))
+			wait = 1;
+		else
+			wait = MIN(wait * 2, 50);
 	}
-	die("cannot grab focus");
+	timing_phase("grabfocus", t);
+	trace_end("grabfocus", t);
 }
 
-static void grabkeyboard(void) {
-	struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000  };
-	int i;
+static int grabkeyboard(void) {
+	XEvent ev;
+	int attempts = 0, focus, ret = 1, wait = 1;
+	double t = timing_now();
 
 	if (embed)
-		return;
+		return 1;
+	/* focus events on the root tell us when another client ungrabs */
+	XSelectInput(dpy, root, FocusChangeMask);
 	/* try to grab keyboard, we may have to wait for another process to ungrab */
-	for (i = 0; i < 100; i++) {
+	for (;;) {
+		attempts++;
+		roundtrips++;
 		if (XGrabKeyboard(dpy, DefaultRootWindow(dpy), True, GrabModeAsync,
 		                  GrabModeAsync, CurrentTime) == GrabSuccess)
-			return;
-		nanosleep(&ts, NULL);
+			break;
+		if (timing_now() - t > 10000) {
+			ret = 0;
+			break;
+		}
+		/* key events stay queued and are handled by run() once we have
+		 * the grab, only the focus changes are consumed here */
+		waitevent(wait);
+		for (focus = 0; XCheckTypedEvent(dpy, FocusIn, &ev) ||
+		                XCheckTypedEvent(dpy, FocusOut, &ev); focus = 1)
+			;
+		wait = focus ? 1 : MIN(wait * 2, 50);
 	}
-	die("cannot grab keyboard");
+	XSelectInput(dpy, root, NoEventMask);
+	timing_phase("grabkeyboard", t);
+	timing_value("grab_attempts", attempts);
+	trace_arg("grabkeyboard", t, attempts);
+	return ret;
 }
 
-int compare_distance(const void *a, const void *b) {
-	struct item *da = *(struct item **) a;
-	struct item *db = *(struct item **) b;
-	if (!db) return 1;
-	if (!da) return -1;
-	return da->distance == db->distance ? 0 : da->distance < db->distance ? -1 : 1;
-}
 
-static inline void fuzzymatchdoitem(char *search, int search_len, struct item *it, int *number_of_matches, int matching_path) {
-	it->distance = 0;
-	if (search_len) {
-		if (search_len > it->len) return;
-		int i = 0, j = 0;
-		int match = 0;
-		int matchci = 0;
-		int matchdis = 0;
-		int matchcontinuous = 0;
-		int continuous = 0;
-		for (char *c = it->text; *c; ++c, ++j) {
-			if (search[i] == *c) {
-				match += 1; matchci += 1;
-				matchdis += j;
-			} else if (!casesensitive && tolower(search[i]) == tolower(*c)) {
-				matchci += 1;
-				matchdis += j;
-			} else {
-				matchcontinuous += continuous;
-				continuous = 0;
-				++j;
-				continue;
-			}
-			++continuous;
-			++i; ++j;
-		}
-		matchcontinuous += continuous;
-		if (search[i] != '\0') return;
-		it->distance += (float)match * score_letter_match;
-		it->distance += (float)matchci * score_letterci_match;
-		it->distance += (float)matchcontinuous * score_continuous;
-		if (matchci > 0) it->distance -= (float)matchdis * score_near_start;
-		if (match == it->len) it->distance += score_exact_match;
-		if (matchci == it->len) it->distance += score_close_match;
-	}
-	if (it->hp) it->distance += score_hp;
-	if (it->file) it->distance += it->folder ? score_folder : score_file;
-	if (it->file && matching_path) it->distance += score_path;
-	appenditem(it, &matches, &matchend);
-	(*number_of_matches)++;
-}
 
-void fuzzymatch(void) {
-	/* bang - we have so much memory */
-	struct item *it;
-	struct item **fuzzymatches = NULL;
-	int number_of_matches = 0, i;
 
+static void fuzzymatch(void) {
 	// TODO put all of this into configs
 	int matching_path = 0;
 	char *word = text;
 	char *base = text;
-	int base_len = 0;
+	size_t n;
+	double t, tr;
 	for (char *c = text; *c; ++c) {
 		if (*c == ' ')
 			word = base = c + 1;
@@ -437,14 +567,11 @@ void fuzzymatch(void) {
 			matching_path = 1;
 		}
 	}
-	base_len = strlen(base);
 
 	matches = matchend = NULL;
 
 	/* walk through all items */
-	for (it = items; it && it->text; ++it) {
-		fuzzymatchdoitem(base, base_len, it, &number_of_matches, matching_path);
-	}
+	n = match_fuzzy(&matchconf, base, matching_path, items, &matches, &matchend);
 
 	/* walk through directory */
 	if (1) {
@@ -461,86 +588,42 @@ void fuzzymatch(void) {
 			snprintf(buf, sizeof buf, "%s/%.*s", path, (int)(base - word), word);
 			path = buf;
 		}
+		t = stats_start();
+		tr = trace_begin();
 		readfolder(path);
-		for (it = files; it && it->text; ++it) {
-			fuzzymatchdoitem(base, base_len, it, &number_of_matches, matching_path);
-		}
+		stats_time(StatReadfolder, t);
+		trace_end("readfolder", tr);
+		n += match_fuzzy(&matchconf, base, matching_path, files, &matches, &matchend);
 	}
 
-	if (number_of_matches) {
-		/* initialize array with matches */
-		if (!(fuzzymatches = realloc(fuzzymatches, number_of_matches * sizeof(struct item*))))
-			die("cannot realloc %u bytes:", number_of_matches * sizeof(struct item*));
-		for (i = 0, it = matches; it && i < number_of_matches; i++, it = it->right) {
-			fuzzymatches[i] = it;
-		}
-		/* sort matches according to distance */
-		qsort(fuzzymatches, number_of_matches, sizeof(struct item*), compare_distance);
-		/* rebuild list of matches */
-		matches = matchend = NULL;
-		for (i = 0; i < number_of_matches; ++i) {
-			it = fuzzymatches[i];
-			if (!it || !it->text) continue;
-			appenditem(it, &matches, &matchend);
-		}
-		free(fuzzymatches);
-	}
-	curr = sel = matches;
-	calcoffsets();
+	match_rank(&matches, &matchend, n);
 }
 
-static void match(void) {
-	if (fuzzy) {
-		fuzzymatch();
-		return;
-	}
-	static char **tokv = NULL;
-	static int tokn = 0;
+static void swappath(void);
 
-	char buf[sizeof text], *s;
-	int i, tokc = 0;
-	size_t len, textsize;
-	struct item *item, *lprefix, *lsubstr, *prefixend, *substrend;
+/* -F with prefixindex: the index of items, made again for another list */
+static void indexitems(void) {
+	if (fuzzy || !prefixindex || !items ||
+	    (pindex.list == items && pindex.casesensitive == matchconf.casesensitive))
+		return;
+	match_index(&pindex, &matchconf, items);
+}
 
-	strcpy(buf, text);
-	/* separate input text into tokens to be matched individually */
-	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
-		if (++tokc > tokn && !(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
-			die("cannot realloc %zu bytes:", tokn * sizeof *tokv);
-	len = tokc ? strlen(tokv[0]) : 0;
+static void match(void) {
+	double t = stats_start(), tr = trace_begin();
 
-	matches = lprefix = lsubstr = matchend = prefixend = substrend = NULL;
-	textsize = strlen(text) + 1;
-	for (item = items; item && item->text; item++) {
-				break;
-		if (i != tokc) /* not all tokens match */
-			continue;
-		/* exact matches go first, then prefixes, then substrings */
-		if (!tokc || !fstrncmp(text, item->text, textsize))
-			appenditem(item, &matches, &matchend);
-		else if (!fstrncmp(tokv[0], item->text, len))
-			appenditem(item, &lprefix, &prefixend);
-		else
-			appenditem(item, &lsubstr, &substrend);
-	}
-	if (lprefix) {
-		if (matches) {
-			matchend->right = lprefix;
-			lprefix->left = matchend;
-		} else
-			matches = lprefix;
-		matchend = prefixend;
-	}
-	if (lsubstr) {
-		if (matches) {
-			matchend->right = lsubstr;
-			lsubstr->left = matchend;
-		} else
-			matches = lsubstr;
-		matchend = substrend;
+	if (pathmode)
+		swappath();
+	if (fuzzy)
+		fuzzymatch();
+	else {
+		indexitems();
+		match_tokens(&matchconf, prefixindex ? &pindex : NULL, text, items, &matches, &matchend);
 	}
 	curr = sel = matches;
 	calcoffsets();
+	stats_time(StatMatch, t);
+	trace_end("match", tr);
 }
 
 static void insert(const char *str, ssize_t n) {
@@ -578,6 +661,107 @@ static void movewordedge(int dir) {
 	}
 }
 
+/* expand %s and %e, the command quoted for single quotes, in format */
+static void formatcmd(FILE *fp, const char *format, const char *cmd) {
+	int percentage = 0;
+	for (const char *p = format; *p != '\0'; ++p) {
+		if (*p == '%') {
+			percentage = 1;
+		} else if (percentage == 1) {
+			if (*p == 's') {
+				fputs(cmd, fp);
+			} else if (*p == 'e') {
+				for (const char *q = cmd; *q != '\0'; ++q) {
+					if (*q == '\'') {
+						fputc('\\', fp);
+						fputc('\'', fp);
+					} else {
+						fputc(*q, fp);
+					}
+				}
+			} else {
+				fputc('%', fp);
+				fputc(*p, fp);
+			}
+			percentage = 0;
+		} else {
+			fputc(*p, fp);
+		}
+	}
+	if (percentage == 1) fputc('%', fp);
+}
+
+/* anything beyond words separated by spaces is left to the shell */
+static int shellsyntax(const char *cmd) {
+	return cmd[strcspn(cmd, "\t\n!\"#$%&'()*;<=>?[\\]`{|}~")] != '\0';
+}
+
+/* -x: start cmd in a new session, a plain command straight from $PATH and
+ * anything else, or a terminal command, through $SHELL -c and the format.
+ * Returns 0 if it was started. */
+static int spawncmd(const char *cmd, int terminal) {
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+	char *sh = getenv("SHELL"), *home = getenv("HOME"), *buf = NULL, *p, **argv;
+	size_t len = 0, n = 0;
+	double t = timing_now();
+	sigset_t sigs;
+	pid_t pid;
+	int ret = -1, direct = !terminal && !shellsyntax(cmd);
+	FILE *fp;
+
+	if (!sh || !sh[0])
+		sh = "/bin/sh";
+	/* the client ignores SIGPIPE, the command should not */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGPIPE);
+	sigaddset(&sigs, SIGCHLD);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, SPAWNFLAGS | POSIX_SPAWN_SETSIGDEF);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+#ifdef SPAWNCHDIR
+	if (home && *home)
+		posix_spawn_file_actions_addchdir_np(&actions, home);
+#else
+	direct = 0;
+#endif
+
+	if (direct) {
+		if (!(buf = strdup(cmd)))
+			die("strdup:");
+		argv = ecalloc(strlen(cmd) / 2 + 2, sizeof(*argv));
+		for (p = strtok(buf, " "); p; p = strtok(NULL, " "))
+			argv[n++] = p;
+		if (n)
+			ret = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+		free(argv);
+		free(buf);
+		buf = NULL;
+	}
+	if (ret) {
+		/* shell syntax, a builtin or not found in $PATH */
+		if (!(fp = open_memstream(&buf, &len)))
+			die("open_memstream:");
+		formatcmd(fp, terminal ? TERMFORMAT : CMDFORMAT, cmd);
+		fclose(fp);
+		ret = posix_spawn(&pid, sh, &actions, &attr,
+		                  (char *[]){ sh, "-c", buf, NULL }, environ);
+		free(buf);
+	}
+	if (ret)
+		fprintf(stderr, "dmenu: cannot run %s: %s\n", cmd, strerror(ret));
+	else {
+		timing_phase("spawn", t);
+		trace_end("spawn", t);
+	}
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	return ret;
+}
+
 static void docommand(int forcetext, int terminal) {
 	char *cmd = NULL;
 	if (forcetext) {
@@ -600,34 +784,20 @@ static void docommand(int forcetext, int terminal) {
 				cmd = sel->text;
 		}
 	}
-	char *format = terminal ? TERMFORMAT : CMDFORMAT;
-	int percentage = 0;
-	for (char *p = format; *p != '\0'; ++p) {
-		if (*p == '%') {
-			percentage = 1;
-		} else if (percentage == 1) {
-			if (*p == 's') {
-				fputs(cmd, stdout);
-			} else if (*p == 'e') {
-				for (char *q = cmd; *q != '\0'; ++q) {
-					if (*q == '\'') {
-						putchar('\\');
-						putchar('\'');
-					} else {
-						putchar(*q);
-					}
-				}
-			} else {
-				putchar('%');
-				putchar(*p);
-			}
-			percentage = 0;
-		} else {
-			putchar(*p);
-		}
+	if (execmode && daemonmode) {
+		/* the client starts it, in its own environment */
+		if (cmd)
+			fprintf(out, "%c%s", terminal ? 't' : 'c', cmd);
+	} else if (execmode) {
+		if (cmd)
+			spawncmd(cmd, terminal);
+	} else {
+		formatcmd(out, terminal ? TERMFORMAT : CMDFORMAT, cmd);
+		fputc('\n', out);
+		fflush(out);
 	}
-	if (percentage == 1) putchar('%');
-	putchar('\n');
+	if (histfile && cmd && frecency_hit(histfile, cmd) < 0)
+		fprintf(stderr, "dmenu: cannot write %s: %s\n", histfile, strerror(errno));
 }
 
 static void keypress(XKeyEvent *ev) {
@@ -703,9 +873,8 @@ static void keypress(XKeyEvent *ev) {
 		case XK_Return:
 		case XK_KP_Enter:
 			docommand(ev->state & ShiftMask, 1);
-			cleanup();
-			exit(0);
-			break;
+			quit(0);
+			return;
 		case XK_bracketleft:
 		case XK_w:
 		case XK_W:
@@ -715,8 +884,8 @@ static void keypress(XKeyEvent *ev) {
 		case XK_D:
 		case XK_c:
 		case XK_C:
-			cleanup();
-			exit(1);
+			quit(1);
+			return;
 		default:
 			return;
 		}
@@ -778,8 +947,8 @@ insert:
 		sel = matchend;
 		break;
 	case XK_Escape:
-		cleanup();
-		exit(1);
+		quit(1);
+		return;
 	case XK_Home:
 	case XK_KP_Home:
 		if (sel == matches) {
@@ -841,9 +1010,8 @@ insert:
 	case XK_Return:
 	case XK_KP_Enter:
 		docommand(ev->state & ShiftMask, 0);
-		cleanup();
-		exit(0);
-		break;
+		quit(0);
+		return;
 	case XK_Right:
 		if (columns > 1 && sel) {
 			tmpsel = sel;
@@ -944,17 +1112,18 @@ static void paste() {
 	drawmenu();
 }
 
-static void readstdin(void) {
+static size_t readitems(FILE *fp, struct item **list) {
 	char *line = NULL;
 	size_t i, itemsiz = 0, linesiz = 0;
 	ssize_t len;
-	
+	struct item *it;
+
 	itemsiz = 1024;
-	if (!(items = malloc(itemsiz * sizeof(*items))))
-		die("cannot realloc %zu bytes:", itemsiz * sizeof(*items));
+	if (!(it = malloc(itemsiz * sizeof(*it))))
+		die("cannot realloc %zu bytes:", itemsiz * sizeof(*it));
 
-	/* read each line from stdin and add it to the item list */
-	for (i = 0; (len = getline(&line, &linesiz, stdin)) != -1; i++) {
+	/* read each line and add it to the item list */
+	for (i = 0; (len = getline(&line, &linesiz, fp)) != -1; i++) {
 		if (line[len - 1] == '\n') {
 			line[len - 1] = '\0';
 			len -= 1;
@@ -965,42 +1134,383 @@ static void readstdin(void) {
 		}
 		if (i + 1 >= itemsiz) {
 			itemsiz += 256;
-			if (!(items = realloc(items, itemsiz * sizeof(*items))))
-				die("cannot realloc %zu bytes:", itemsiz * sizeof(*items));
+			if (!(it = realloc(it, itemsiz * sizeof(*it))))
+				die("cannot realloc %zu bytes:", itemsiz * sizeof(*it));
 		}
-		items[i].folder = items[i].file = 0;
-		items[i].hp = line[0] == hpchar;
-		items[i].len = strlen(line + items[i].hp);
-		if (!(items[i].text = malloc(items[i].len + 1))) die("malloc");
-		memcpy(items[i].text, line + items[i].hp, items[i].len + 1);
+		it[i].folder = it[i].file = 0;
+		it[i].bonus = 0;
+		it[i].w = 0;
+		it[i].hp = line[0] == hpchar;
+		it[i].len = strlen(line + it[i].hp);
+		if (!(it[i].text = malloc(it[i].len + 1))) die("malloc");
+		memcpy(it[i].text, line + it[i].hp, it[i].len + 1);
+		it[i].sig = match_signature(it[i].text);
 	}
 	free(line);
-	if (items) {
-		items[i].text = NULL;
-		items[i].len = 0;
+	it[i].text = NULL;
+	it[i].len = 0;
+	*list = it;
+	return i;
+}
+
+/* the bonus of each item for having been selected lately; the daemon may
+ * keep a list from a session with -H to one without */
+static void loadfrecency(struct item *list) {
+	Frecency *f = histfile ? frecency_open(histfile) : NULL;
+	struct item *it;
+	double hits;
+
+	if (!f && !daemonmode)
+		return;
+	for (it = list; it && it->text; it++)
+		it->bonus = f && (hits = frecency_get(f, it->text)) > 0 ?
+		            score_frecency * log2(1 + hits) : 0;
+	frecency_close(f);
+}
+
+static int writeall(int fd, const char *buf, size_t n) {
+	ssize_t r;
+
+	while (n) {
+		if ((r = write(fd, buf, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		n -= r;
+	}
+	return 0;
+}
+
+/* file in the directory dmenu_path keeps its cache in, -1 if too long */
+static int cachefile(char *buf, size_t n, const char *name) {
+	const char *dir = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+
+	if (dir && dir[0])
+		return (size_t)snprintf(buf, n, "%s/%s", dir, name) < n ? 0 : -1;
+	return (size_t)snprintf(buf, n, "%s/.cache/%s", home ? home : "", name) < n ? 0 : -1;
+}
+
+/* what dmenu_path does: rescan the directories of $PATH that changed since
+ * the manifest and rewrite the cache */
+static void scanpath(void) {
+	PathDir *dirs;
+	char file[PATH_MAX], tmp[PATH_MAX], *list, *path = getenv("PATH");
+	size_t n, len;
+	int fd, err;
+
+	if (cachefile(file, sizeof file, "") < 0)
+		return;
+	mkdir(file, 0755);
+	dirs = path_dirs(path ? path : "", &n);
+	if (!cachefile(file, sizeof file, "dmenu_run.bin") && path_load(dirs, n, file)) {
+		path_scan(dirs, n);
+		pthread_mutex_lock(&pathwrite);
+		path_save(dirs, n, file);
+		pthread_mutex_unlock(&pathwrite);
+	}
+	len = path_list(dirs, n, hpchar, &list);
+	/* replace the cache at once, a mapping of the old one stays valid */
+	pthread_mutex_lock(&pathwrite);
+	if (!cachefile(file, sizeof file, "dmenu_run") &&
+	    (size_t)snprintf(tmp, sizeof tmp, "%s.%d", file, (int)getpid()) < sizeof tmp &&
+	    (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		err = writeall(fd, list, len);
+		if (close(fd) < 0 || err < 0 || rename(tmp, file) < 0)
+			unlink(tmp);
 	}
-	lines = MIN(lines, i);
+	pthread_mutex_unlock(&pathwrite);
+	free(list);
+	path_free(dirs, n);
+}
+
+/* like stest -dqn: is a directory of $PATH newer than the cache */
+static int stalepath(const struct stat *cache) {
+	PathDir *dirs;
+	struct stat st;
+	char *path = getenv("PATH");
+	size_t i, n;
+	int stale = 0;
+
+	dirs = path_dirs(path ? path : "", &n);
+	for (i = 0; i < n && !stale; i++)
+		stale = !stat(dirs[i].path, &st) && S_ISDIR(st.st_mode) &&
+		        (st.st_mtim.tv_sec > cache->st_mtim.tv_sec ||
+		         (st.st_mtim.tv_sec == cache->st_mtim.tv_sec &&
+		          st.st_mtim.tv_nsec > cache->st_mtim.tv_nsec));
+	path_free(dirs, n);
+	return stale;
+}
+
+/* the items of the non-empty lines from buf to end, the last one ending in
+ * a newline; they point into buf, the newlines become NULs */
+static size_t parseitems(char *buf, char *end, struct item **list) {
+	struct item *it;
+	char *p, *nl;
+	size_t n = 0;
+
+	for (p = buf; p < end && (p = memchr(p, '\n', end - p)); p++)
+		n++;
+	it = ecalloc(n + 1, sizeof(*it));
+	for (n = 0, p = buf; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		*nl = '\0';
+		if (nl == p)
+			continue;
+		it[n].hp = *p == hpchar;
+		it[n].text = p + it[n].hp;
+		it[n].len = nl - it[n].text;
+		it[n].sig = match_signature(it[n].text);
+		n++;
+	}
+	*list = it;
+	return n;
+}
+
+/* Map the cache privately and turn it into items in place: every newline
+ * becomes the terminating NUL. Writing them copies each page once, but
+ * there is no read() and no allocation per item. Returns the number of
+ * items or -1 if there is no usable cache. */
+static ssize_t mappath(struct stat *st) {
+	struct item *it;
+	char file[PATH_MAX], *map = NULL, *end;
+	size_t n;
+	int fd;
+
+	if (cachefile(file, sizeof file, "dmenu_run") < 0 || (fd = open(file, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, st) < 0 || (st->st_size > 0 &&
+	    (map = mmap(NULL, st->st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	end = map + st->st_size;
+	/* the last line needs its newline to become a string */
+	if (map && end[-1] != '\n') {
+		munmap(map, st->st_size);
+		return -1;
+	}
+
+	n = parseitems(map, end, &it);
+	freepath();
+	pathmap = map;
+	pathmaplen = st->st_size;
+	items = it;
+	return n;
+}
+
+static void *refreshthread(void *arg) {
+	double t = timing_now();
+
+	scanpath();
+	timing_phase("scanpath", t);
+	trace_end("scanpath", t);
+	pthread_mutex_lock(&pathlock);
+	pathrefresh = 0;
+	pathfresh = 1;
+	pthread_mutex_unlock(&pathlock);
+	return NULL;
+}
+
+/* items of -path: the cache as it is, refreshed in the background if a
+ * directory changed; only the first run has to wait for the scan */
+static size_t readpath(void) {
+	struct stat st;
+	pthread_t thread;
+	ssize_t n;
+
+	if ((n = mappath(&st)) < 0) {
+		scanpath();
+		if ((n = mappath(&st)) < 0)
+			die("cannot read the $PATH cache");
+	} else if (stalepath(&st)) {
+		pthread_mutex_lock(&pathlock);
+		if (!pathrefresh && !pthread_create(&thread, NULL, refreshthread, NULL)) {
+			pathrefresh = 1;
+			pthread_detach(thread);
+		}
+		pthread_mutex_unlock(&pathlock);
+	}
+	return n;
+}
+
+/* take the cache a background scan left behind */
+static void swappath(void) {
+	struct stat st;
+	int fresh;
+
+	pthread_mutex_lock(&pathlock);
+	fresh = pathfresh;
+	pathfresh = 0;
+	pthread_mutex_unlock(&pathlock);
+	if (fresh && mappath(&st) >= 0) {
+		loadfrecency(items);
+		itemsw = -1;
+		snapdirty = 0; /* the snapshot was of the old list */
+	}
+}
+
+/* the loaded font set, as fontconfig resolved it for this display */
+static uint64_t fontkey(void) {
+	uint64_t h = 0;
+	FcChar8 *name;
+	Fnt *f;
+
+	/* the fonts of the set, not the fallbacks drawing added or which of
+	 * the set happen to be opened yet */
+	for (f = drw->fonts; f; f = f->next)
+		if (f->pattern && (name = FcNameUnparse(f == drw->fonts ? f->xfont->pattern : f->pattern))) {
+			h = snap_hash(name, strlen((char *)name), h);
+			free(name);
+		}
+	return h;
+}
+
+/* the items of the snapshot taken of data, NULL if there is none */
+static struct item *loadsnapshot(const char *data, size_t len, size_t *n) {
+	struct item *it;
+	char file[PATH_MAX];
+
+	snapkey = snap_hash(data, len, 0);
+	if (cachefile(file, sizeof file, "dmenu_snapshot") < 0 ||
+	    !(it = snap_load(&snap, file, snapkey, n))) {
+		snapdirty = 1;
+		return NULL;
+	}
+	return it;
+}
+
+/* -snapshot: the input in one piece, its items from the snapshot of the
+ * last start with the same input or else parsed in place */
+static size_t readsnapshot(FILE *fp) {
+	size_t n, len = 0, siz = BUFSIZ;
+	struct item *it;
+
+	inbuf = ecalloc(siz, 1);
+	while ((n = fread(inbuf + len, 1, siz - len - 1, fp)) > 0)
+		if ((len += n) == siz - 1 && !(inbuf = realloc(inbuf, (siz *= 2))))
+			die("cannot realloc %zu bytes:", siz);
+	if (ferror(fp))
+		die("cannot read the items:");
+	if ((it = loadsnapshot(inbuf, len, &n))) {
+		free(inbuf);
+		inbuf = NULL;
+		items = it;
+		return n;
+	}
+	if (len && inbuf[len - 1] != '\n')
+		inbuf[len++] = '\n';
+	return parseitems(inbuf, inbuf + len, &items);
+}
+
+/* the snapshot is saved after the first frame, when the widths are known */
+static void savesnapshot(void) {
+	char file[PATH_MAX];
+	size_t n = 0;
+
+	if (!snapshot || !snapdirty)
+		return;
+	while (items && items[n].text)
+		n++;
+	if (cachefile(file, sizeof file, "dmenu_snapshot") < 0 ||
+	    snap_save(file, snapkey, fontkey(), items, n, itemswguess ? -1 : itemsw) < 0)
+		fprintf(stderr, "dmenu: cannot write the snapshot: %s\n", strerror(errno));
+	snapdirty = 0;
+}
+
+/* the widths of a snapshot hold for the font set it was taken with */
+static void checksnapshot(void) {
+	struct item *it;
+
+	if (!snapshot || !snap.map)
+		return;
+	if (snap.fontkey == fontkey()) {
+		itemsw = snap.maxw;
+		return;
+	}
+	for (it = items; it && it->text; it++)
+		it->w = 0;
+	snapdirty = 1;
+}
+
+static void readstdin(void) {
+	FILE *fp = stdin;
+	struct item *it;
+	size_t n;
+
+	if (pathmode) {
+		n = readpath();
+		/* the list is mapped already, what is left to skip is measuring */
+		if (snapshot && (it = loadsnapshot(pathmap, pathmaplen, &n))) {
+			free(items);
+			items = it;
+		}
+	} else {
+		if (corpus && !(fp = fopen(corpus, "r")))
+			die("cannot open corpus '%s':", corpus);
+		n = snapshot ? readsnapshot(fp) : readitems(fp, &items);
+		if (fp != stdin)
+			fclose(fp);
+	}
+	loadfrecency(items);
+	indexitems();
+	timing_value("items", n);
+	lines = MIN(lines, n);
+}
+
+static void *readthread(void *arg) {
+	double t = timing_now();
+
+	readstdin();
+	timing_phase("readstdin", t);
+	trace_end("readstdin", t);
+	return NULL;
 }
 
 static void run(void) {
+	struct pollfd pfd[] = {
+		{ .fd = ConnectionNumber(dpy), .events = POLLIN },
+		{ .fd = stats_fd(), .events = POLLIN }, /* SIGUSR1 */
+	};
+	unsigned long req;
 	XEvent ev;
-
-	while (!XNextEvent(dpy, &ev)) {
+	double t, tr;
+
+	stats_reset();
+	while (running) {
+		/* wait here rather than in XNextEvent() so SIGUSR1 gets through */
+		if (!XPending(dpy)) {
+			if (poll(pfd, LENGTH(pfd), -1) < 0 && errno != EINTR)
+				die("poll:");
+			if (pfd[1].revents & POLLIN)
+				stats_signal();
+			continue;
+		}
+		XNextEvent(dpy, &ev);
 		if (XFilterEvent(&ev, win))
 			continue;
 		switch(ev.type) {
 		case DestroyNotify:
 			if (ev.xdestroywindow.window != win)
 				break;
-			cleanup();
-			exit(1);
+			quit(1);
+			break;
 		case FocusIn:
 			/* regrab focus from parent window */
-			if (ev.xfocus.window != win)
+			if (embed && ev.xfocus.window != win)
 				grabfocus();
 			break;
 		case KeyPress:
+			t = stats_start();
+			tr = trace_begin();
+			req = NextRequest(dpy);
 			keypress(&ev.xkey);
+			stats_count(StatRequests, NextRequest(dpy) - req);
+			stats_time(StatKey, t);
+			trace_arg("keypress", tr, ev.xkey.keycode);
+			stats_key();
 			break;
 		case KeyRelease:
 			keyrelease(&ev.xkey);
@@ -1010,8 +1520,11 @@ static void run(void) {
 				paste();
 			break;
 		case Expose:
-			if (ev.xexpose.count == 0)
+			if (ev.xexpose.count == 0) {
 				drw_map(drw, win, 0, 0, mw, mh);
+				if (!exposed++)
+					timing_mark("expose");
+			}
 			/* Fall through */
 		case VisibilityNotify:
 			XRaiseWindow(dpy, win);
@@ -1021,25 +1534,38 @@ static void run(void) {
 }
 
 static void setup(void) {
-	int x, y, i = 0, j;
+	char *names[] = { "CLIPBOARD", "UTF8_STRING" };
+	Atom atoms[LENGTH(names)];
+	int j;
+	/* init appearance */
+	unsigned int alphas[2] = { OPAQUE, alpha };
+	for (j = 0; j < SchemeLast; j++)
+		scheme[j] = drw_scm_create(drw, colors[j], alphas, 2);
+
+	/* one request for all atoms instead of one round trip each */
+	XInternAtoms(dpy, names, LENGTH(names), False, atoms);
+	roundtrips++;
+	clip = atoms[0];
+	utf8 = atoms[1];
+
+	/* input methods */
+	if ((xim = XOpenIM(dpy, NULL, NULL, NULL)) == NULL)
+		die("XOpenIM failed: could not open input device");
+}
+
+static void openmenu(void) {
+	int x, y, i = 0;
 	unsigned int du;
 	XSetWindowAttributes swa;
-	XIM xim;
 	Window w, dw, *dws;
 	XWindowAttributes wa;
 	XClassHint ch = {"dmenu", "dmenu"};
+	double t;
 #ifdef XINERAMA
 	XineramaScreenInfo *info;
 	Window pw;
-	int a, di, n, area = 0;
+	int a, di, j, n, area = 0;
 #endif
-	/* init appearance */
-	unsigned int alphas[2] = { OPAQUE, alpha };
-	for (j = 0; j < SchemeLast; j++)
-		scheme[j] = drw_scm_create(drw, colors[j], alphas, 2);
-
-	clip = XInternAtom(dpy, "CLIPBOARD",   False);
-	utf8 = XInternAtom(dpy, "UTF8_STRING", False);
 
 	/* calculate menu geometry */
 	bh = drw->fonts->h + 2;
@@ -1048,29 +1574,38 @@ static void setup(void) {
 	promptw = (prompt && *prompt) ? TEXTW(prompt) - lrpad / 4 : 0;
 #ifdef XINERAMA
 	i = 0;
-	if (parentwin == root && (info = XineramaQueryScreens(dpy, &n))) {
-		XGetInputFocus(dpy, &w, &di);
-		if (mon >= 0 && mon < n)
+	t = timing_now();
+	if (parentwin == root && (roundtrips++, info = XineramaQueryScreens(dpy, &n))) {
+		if (mon >= 0 && mon < n) {
 			i = mon;
-		else if (w != root && w != PointerRoot && w != None) {
-			/* find top-level window containing current input focus */
-			do {
-				if (XQueryTree(dpy, (pw = w), &dw, &w, &dws, &du) && dws)
-					XFree(dws);
-			} while (w != root && w != pw);
-			/* find xinerama screen with which the window intersects most */
-			if (XGetWindowAttributes(dpy, pw, &wa))
-				for (j = 0; j < n; j++)
-					if ((a = INTERSECT(wa.x, wa.y, wa.width, wa.height, info[j])) > area) {
-						area = a;
-						i = j;
-					}
+		} else {
+			/* the focus only matters when no monitor was asked for */
+			XGetInputFocus(dpy, &w, &di);
+			roundtrips++;
+			if (w != root && w != PointerRoot && w != None) {
+				/* find top-level window containing current input focus */
+				do {
+					roundtrips++;
+					if (XQueryTree(dpy, (pw = w), &dw, &w, &dws, &du) && dws)
+						XFree(dws);
+				} while (w != root && w != pw);
+				/* find xinerama screen with which the window intersects most */
+				roundtrips++;
+				if (XGetWindowAttributes(dpy, pw, &wa))
+					for (j = 0; j < n; j++)
+						if ((a = INTERSECT(wa.x, wa.y, wa.width, wa.height, info[j])) > area) {
+							area = a;
+							i = j;
+						}
+			}
 		}
 		/* no focused window is on screen, so use pointer location instead */
-		if (mon < 0 && !area && XQueryPointer(dpy, root, &dw, &dw, &x, &y, &di, &di, &du))
+		if (mon < 0 && !area && (roundtrips++, XQueryPointer(dpy, root, &dw, &dw, &x, &y, &di, &di, &du)))
 			for (i = 0; i < n; i++)
 				if (INTERSECT(x, y, 1, 1, info[i]) != 0)
 					break;
+		timing_phase("xinerama", t);
+		trace_end("xinerama", t);
 
 		if (centered) {
 			mw = MIN(MAX(max_textw() + promptw, min_width), info[i].width);
@@ -1086,9 +1621,16 @@ static void setup(void) {
 	} else
 #endif
 	{
-		if (!XGetWindowAttributes(dpy, parentwin, &wa))
-			die("could not get embedding window attributes: 0x%lx",
-			    parentwin);
+		if (parentwin == root && !daemonmode) {
+			/* known since the connection was set up, no need to ask */
+			wa.width = DisplayWidth(dpy, screen);
+			wa.height = DisplayHeight(dpy, screen);
+		} else {
+			roundtrips++;
+			if (!XGetWindowAttributes(dpy, parentwin, &wa))
+				die("could not get embedding window attributes: 0x%lx",
+				    parentwin);
+		}
 
 		if (centered) {
 			mw = MIN(MAX(max_textw() + promptw, min_width), wa.width);
@@ -1102,23 +1644,22 @@ static void setup(void) {
 	}
 	promptw = (prompt && *prompt) ? TEXTW(prompt) - lrpad / 4 : 0;
 	inputw = mw / 3; /* input width: ~33% of monitor width */
+	t = timing_now();
 	match();
+	timing_phase("match", t);
 
 	/* create menu window */
 	swa.override_redirect = True;
 	swa.background_pixel = scheme[SchemeNorm][ColBg].pixel;
 	swa.border_pixel = 0;
 	swa.colormap = cmap;
-	swa.event_mask = ExposureMask | KeyPressMask | KeyReleaseMask | VisibilityChangeMask;
+	swa.event_mask = ExposureMask | KeyPressMask | KeyReleaseMask | VisibilityChangeMask |
+	                 FocusChangeMask;
 	win = XCreateWindow(dpy, root, x, y, mw, mh, 0,
 	                    depth, CopyFromParent, visual,
 	                    CWOverrideRedirect | CWBackPixel | CWBorderPixel | CWColormap | CWEventMask, &swa);
 	XSetClassHint(dpy, win, &ch);
 
-	/* input methods */
-	if ((xim = XOpenIM(dpy, NULL, NULL, NULL)) == NULL)
-		die("XOpenIM failed: could not open input device");
-
 	xic = XCreateIC(xim, XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
 	                XNClientWindow, win, XNFocusWindow, win, NULL);
 
@@ -1126,6 +1667,7 @@ static void setup(void) {
 	if (embed) {
 		XReparentWindow(dpy, win, parentwin, x, y);
 		XSelectInput(dpy, parentwin, FocusChangeMask | SubstructureNotifyMask);
+		roundtrips++;
 		if (XQueryTree(dpy, parentwin, &dw, &w, &dws, &du) && dws) {
 			for (i = 0; i < du && dws[i] != win; ++i)
 				XSelectInput(dpy, dws[i], FocusChangeMask);
@@ -1134,23 +1676,359 @@ static void setup(void) {
 		grabfocus();
 	}
 	drw_resize(drw, mw, mh);
+	/* the XSync in drw_map() completing the first frame is the last one */
+	timing_value("roundtrips", ++roundtrips);
+	roundtrips = 0;
+	t = timing_now();
 	drawmenu();
+	timing_phase("drawmenu", t);
+	exposed = 0;
+}
+
+/* tear down the menu window so the daemon can open the next one */
+static void closemenu(void) {
+	XUngrabKeyboard(dpy, CurrentTime);
+	XDestroyIC(xic);
+	XDestroyWindow(dpy, win);
+	/* drop events still queued for the old window */
+	XSync(dpy, True);
+}
+
+/* The socket of the daemon: in $XDG_RUNTIME_DIR, else in a directory of
+ * our own in /tmp, made if create is set. Returns -1 if that directory is
+ * not ours alone, anyone else could bind the socket first. */
+static int sockpath(char *buf, size_t n, int create) {
+	const char *dir = getenv("XDG_RUNTIME_DIR"), *d = getenv("DISPLAY");
+	char tmp[64];
+	struct stat st;
+
+	if (!d)
+		d = "";
+	if (!dir || !*dir) {
+		snprintf(tmp, sizeof tmp, "/tmp/dmenu-%d", (int)getuid());
+		if (create)
+			mkdir(tmp, 0700);
+		if (lstat(tmp, &st) < 0 || !S_ISDIR(st.st_mode) ||
+		    st.st_uid != getuid() || (st.st_mode & 077))
+			return -1;
+		dir = tmp;
+	}
+	return (size_t)snprintf(buf, n, "%s/dmenu%s.sock", dir, d) < n ? 0 : -1;
+}
+
+/* is the other end of the socket run by our user */
+static int ownpeer(int fd) {
+#ifdef __linux__
+	struct ucred cred;
+	socklen_t len = sizeof cred;
+
+	return !getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) && cred.uid == getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+
+	return !getpeereid(fd, &uid, &gid) && uid == getuid();
+#endif
+}
+
+/* load a corpus once and keep it, reloading only when the file changes */
+static struct corpus *loadcorpus(const char *path) {
+	struct corpus *c;
+	struct stat st;
+	FILE *fp;
+
+	if (stat(path, &st) < 0)
+		return NULL;
+	for (c = corpora; c && strcmp(c->path, path); c = c->next) {}
+	if (c && c->mtime == st.st_mtime)
+		return c;
+	if (!(fp = fopen(path, "r")))
+		return NULL;
+	if (!c) {
+		c = ecalloc(1, sizeof(*c));
+		if (!(c->path = strdup(path)))
+			die("strdup:");
+		c->next = corpora;
+		corpora = c;
+	} else {
+		freeitems(c->items);
+	}
+	c->n = readitems(fp, &c->items);
+	c->mtime = st.st_mtime;
+	c->maxw = -1;
+	fclose(fp);
+	return c;
+}
+
+/* run one menu for a client connected to the daemon */
+/* the menu of a client whose arguments are parsed, its items follow on in */
+static void servemenu(FILE *in) {
+	struct corpus *c = NULL;
+	double t;
+	size_t n;
+
+	t = timing_now();
+	if (corpus && (c = loadcorpus(corpus))) {
+		items = c->items;
+		itemsw = c->maxw;
+		n = c->n;
+	} else if (pathmode) {
+		n = readpath();
+		itemsw = -1;
+	} else {
+		n = readitems(in, &items);
+		itemsw = -1;
+		if (ferror(in)) { /* timed out */
+			freeitems(items);
+			items = NULL;
+			return;
+		}
+	}
+	loadfrecency(items);
+	indexitems();
+	timing_phase("readstdin", t);
+	trace_arg("readstdin", t, n);
+	timing_value("items", n);
+	lines = MIN(lines, n);
+	text[0] = '\0';
+	cursor = 0;
+	ctrlpressed = 0;
+
+	if (grabkeyboard()) {
+		openmenu();
+		running = 1;
+		run();
+		closemenu();
+	}
+
+	if (c)
+		c->maxw = itemsw;
+	else if (pathmode)
+		freepath();
+	else
+		freeitems(items);
+	items = NULL;
+}
+
+static void serve(int fd) {
+	/* everything parseargs() sets for a client, as the daemon started */
+	static struct {
+		int topbar, centered, fuzzy, casesensitive, fast, mon;
+		unsigned int lines, columns;
+		const char *prompt;
+	} dflt;
+	static int saved = 0;
+	char **sargv, **v, *arg = NULL, *reply = NULL, st;
+	size_t argsiz = 0, replylen = 0;
+	ssize_t len = -1;
+	int i, err, sargc = 1;
+	FILE *in;
+
+	if (!saved) {
+		dflt.topbar = topbar; dflt.centered = centered;
+		dflt.fuzzy = fuzzy; dflt.casesensitive = casesensitive;
+		dflt.fast = fast; dflt.mon = mon;
+		dflt.lines = lines; dflt.columns = columns;
+		dflt.prompt = prompt;
+		saved = 1;
+	}
+	topbar = dflt.topbar; centered = dflt.centered;
+	fuzzy = dflt.fuzzy; casesensitive = dflt.casesensitive;
+	fast = dflt.fast; mon = dflt.mon;
+	lines = dflt.lines; columns = dflt.columns;
+	prompt = dflt.prompt;
+	corpus = NULL;
+	histfile = NULL;
+	pathmode = 0;
+	execmode = 0;
+	snapshot = 0; /* the daemon keeps its corpora itself */
+
+	status = 1;
+	if (!(in = fdopen(fd, "r"))) {
+		writeall(fd, "1", 1);
+		close(fd);
+		return;
+	}
+	if (!(out = open_memstream(&reply, &replylen))) {
+		writeall(fd, "1", 1);
+		fclose(in);
+		return;
+	}
+
+	/* arguments come first, each terminated by a NUL, then an empty one */
+	if ((sargv = malloc(sizeof(*sargv))))
+		sargv[0] = "dmenu";
+	err = !sargv;
+	while (!err && (len = getdelim(&arg, &argsiz, '\0', in)) > 1) {
+		if ((v = realloc(sargv, (sargc + 1) * sizeof(*sargv))))
+			sargv = v;
+		if (!v || !(sargv[sargc] = strdup(arg)))
+			err = 1;
+		else
+			sargc++;
+	}
+	free(arg);
+	/* cut short, timed out or an option we cannot take: no menu, status 1 */
+	if (!err && len == 1 && parseargs(sargc, sargv, 1) == 0)
+		servemenu(in);
+
+	/* a status byte, then what the menu printed or the command of -x */
+	fclose(out);
+	st = status ? '1' : '0';
+	if (!writeall(fd, &st, 1))
+		writeall(fd, reply, replylen);
+	free(reply);
+	fclose(in);
+	for (i = 1; i < sargc; i++)
+		free(sargv[i]);
+	free(sargv);
+}
+
+static void daemonrun(void) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = CLIENTTIMEOUT };
+	struct corpus *c;
+	mode_t mask;
+	int fd, cfd;
+
+	signal(SIGPIPE, SIG_IGN);
+	if (sockpath(addr.sun_path, sizeof addr.sun_path, 1) < 0)
+		die("no socket directory of our own, set XDG_RUNTIME_DIR");
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		die("socket:");
+	unlink(addr.sun_path);
+	/* the socket is ours alone */
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(fd, 8) < 0)
+		die("cannot listen on %s:", addr.sun_path);
+	umask(mask);
+
+	/* index the startup corpus now so the first menu does not have to */
+	if (corpus && (c = loadcorpus(corpus))) {
+		items = c->items;
+		itemsw = -1;
+		c->maxw = max_textw();
+		items = NULL;
+	}
+
+	for (;;) {
+		if ((cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			die("accept:");
+		}
+		if (!ownpeer(cfd)) {
+			close(cfd);
+			continue;
+		}
+		/* one client at a time: a stalled one must not hold up the rest */
+		setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+		setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+		serve(cfd);
+	}
+}
+
+/* hand the menu to a running daemon, returns -1 if there is none */
+static int runclient(int argc, char *argv[]) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char buf[BUFSIZ], cwd[PATH_MAX], *reply = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int fd, i, ret;
+	FILE *fp;
+
+	if (sockpath(addr.sun_path, sizeof addr.sun_path, 0) < 0)
+		return -1;
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	/* a daemon of another user would get our items and pick our command */
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0 || !ownpeer(fd)) {
+		close(fd);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-client"))
+			continue;
+		writeall(fd, argv[i], strlen(argv[i]) + 1);
+		if (!strcmp(argv[i], "-corpus") || !strcmp(argv[i], "-H")) {
+			/* the daemon does not share our working directory */
+			if (argv[++i][0] != '/' && getcwd(cwd, sizeof cwd)) {
+				writeall(fd, cwd, strlen(cwd));
+				writeall(fd, "/", 1);
+			}
+			writeall(fd, argv[i], strlen(argv[i]) + 1);
+		}
+	}
+	writeall(fd, "", 1);
+	if (!corpus && !pathmode)
+		while ((n = read(0, buf, sizeof buf)) > 0)
+			writeall(fd, buf, n);
+	shutdown(fd, SHUT_WR);
+
+	/* a status byte, then the output or with -x the command to start here,
+	 * in our environment and working directory */
+	if (!(fp = open_memstream(&reply, &len)))
+		die("open_memstream:");
+	while ((n = read(fd, buf, sizeof buf)) > 0)
+		fwrite(buf, 1, n, fp);
+	fclose(fp);
+	close(fd);
+	if (!len || reply[0] != '0')
+		ret = 1;
+	else if (execmode)
+		ret = len > 2 && spawncmd(reply + 2, reply[1] == 't') ? 1 : 0;
+	else
+		ret = fwrite(reply + 1, 1, len - 1, stdout) != len - 1;
+	free(reply);
+	return ret;
 }
 
 static void usage(void) {
 	die("usage: dmenu [-bfiv] [-p prompt] [-fn font] [-m monitor]\n"
 	    "             [-l lines] [-g colums] [-w windowid] [-a alpha 0-255]\n"
 	    "             [-nb color] [-nf color] [-sb color] [-sf color]\n"
-	    "             [-nhb color] [-nhf color] [-shb color] [-shf color]");
+	    "             [-nhb color] [-nhf color] [-shb color] [-shf color]\n"
+	    "             [-daemon] [-client] [-corpus file] [-path] [-x]\n"
+	    "             [-H file] [-snapshot] [-image]");
 }
 
-int main(int argc, char *argv[]) {
-	XWindowAttributes wa;
-	int i, fast = 0;
+/* options a client of the daemon cannot give: the look is set up once and
+ * the daemon never embeds, nor exits for -v */
+static const char *fixedflags[] = { "-v", "-daemon", "-client", "-image", "-snapshot", NULL };
+static const char *fixedargs[] = {
+	"-fn", "-a", "-w", "-nb", "-nf", "-sb", "-sf", "-nhb", "-nhf", "-shb", "-shf", NULL
+};
+
+static int isopt(const char **opts, const char *arg) {
+	for (; *opts; opts++)
+		if (!strcmp(*opts, arg))
+			return 1;
+	return 0;
+}
+
+/* a bad option: the usage for the command line, -1 for a client, which
+ * must not bring the daemon down */
+static int badarg(int served) {
+	if (!served)
+		usage();
+	return -1;
+}
+
+/* served is set for the arguments of a client, which are freed after its
+ * menu: the options that would keep pointers into them are passed over.
+ * Returns -1 if a client's option is bad. */
+static int parseargs(int argc, char *argv[], int served) {
+	int i;
 
 	for (i = 1; i < argc; i++)
+		if (served && isopt(fixedflags, argv[i]))
+			continue;
+		else if (served && isopt(fixedargs, argv[i]) && i + 1 < argc)
+			i++;
 		/* these options take no arguments */
-		if (!strcmp(argv[i], "-v")) {      /* prints version information */
+		else if (!strcmp(argv[i], "-v")) {      /* prints version information */
 			puts("dmenu-"VERSION);
 			exit(0);
 		} else if (!strcmp(argv[i], "-b")) /* appears at the bottom of the screen */
@@ -1165,8 +2043,20 @@ int main(int argc, char *argv[]) {
 			casesensitive = 1;
 		else if (!strcmp(argv[i], "-I"))   /* case-sensitive item matching */
 			casesensitive = 0;
+		else if (!strcmp(argv[i], "-daemon")) /* keep running and serve clients */
+			daemonmode = 1;
+		else if (!strcmp(argv[i], "-client")) /* let a running daemon show the menu */
+			clientmode = 1;
+		else if (!strcmp(argv[i], "-path"))   /* executables in $PATH, like dmenu_path */
+			pathmode = 1;
+		else if (!strcmp(argv[i], "-snapshot")) /* maps the items of the last start with this input */
+			snapshot = 1;
+		else if (!strcmp(argv[i], "-image"))  /* composes frames client side */
+			imagedraw = 1;
+		else if (!strcmp(argv[i], "-x"))      /* runs the selection instead of printing it */
+			execmode = 1;
 		else if (i + 1 == argc)
-			usage();
+			return badarg(served);
 		/* these options take one argument */
 		else if (!strcmp(argv[i], "-g")) {   /* number of columns in grid */
 			columns = atoi(argv[++i]);
@@ -1200,48 +2090,101 @@ int main(int argc, char *argv[]) {
 			colors[SchemeSelHighlight][ColFg] = argv[++i];
 		else if (!strcmp(argv[i], "-w"))   /* embedding window id */
 			embed = argv[++i];
+		else if (!strcmp(argv[i], "-H"))   /* ranks recent selections first */
+			histfile = argv[++i];
+		else if (!strcmp(argv[i], "-corpus")) /* read items from file, kept by the daemon */
+			corpus = argv[++i];
 		else
-			usage();
+			return badarg(served);
+
+	matchconf = (MatchConf){
+		score_exact_match, score_close_match, score_letter_match,
+		score_letterci_match, score_near_start, score_continuous,
+		score_hp, score_file, score_folder, score_path, casesensitive
+	};
+	return 0;
+}
 
+int main(int argc, char *argv[]) {
+	pthread_t reader;
+	double t;
+	int ret;
+
+	timing_init();
+	stats_init();
+	trace_init();
+	parseargs(argc, argv, 0);
+	if (clientmode && (ret = runclient(argc, argv)) >= 0)
+		return ret;
+	out = stdout;
+	/* before the reader, which folds case and sorts under the locale */
 	if (!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fputs("warning: no locale support\n", stderr);
+	/* items are read while the display and fonts are set up */
+	if (!daemonmode && (ret = pthread_create(&reader, NULL, readthread, NULL)))
+		die("pthread_create: %s", strerror(ret));
+
+	t = timing_now();
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("cannot open display");
+	timing_phase("xopendisplay", t);
+	trace_end("xopendisplay", t);
+	roundtrips++; /* connection setup */
 	screen = DefaultScreen(dpy);
 	root = RootWindow(dpy, screen);
+	if (daemonmode)
+		embed = NULL;
 	if (!embed || !(parentwin = strtol(embed, NULL, 0)))
 		parentwin = root;
-	if (!XGetWindowAttributes(dpy, parentwin, &wa))
-		die("could not get embedding window attributes: 0x%lx",
-		    parentwin);
+	t = timing_now();
 	xinitvisual();
-	drw = drw_create(dpy, screen, root, wa.width, wa.height, visual, depth, cmap);
+	timing_phase("xinitvisual", t);
+	trace_end("xinitvisual", t);
+	/* the embedding window is checked and the pixmap sized in openmenu() */
+	drw = drw_create(dpy, screen, root, DisplayWidth(dpy, screen),
+	                 DisplayHeight(dpy, screen), visual, depth, cmap);
+	if (imagedraw && drw_setbackend(drw, DrwImage) < 0)
+		fputs("warning: -image needs a visual with 8 bit channels\n", stderr);
+	t = timing_now();
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
+	timing_phase("drw_fontset_create", t);
+	trace_end("drw_fontset_create", t);
+	if (cachefile(fontcache, sizeof fontcache, "dmenu_fonts") < 0)
+		fontcache[0] = '\0';
+	else
+		drw_fallback_load(drw, fontcache);
 	lrpad = drw->fonts->h;
 
 #ifdef __OpenBSD__
-	if (pledge("stdio rpath", NULL) == -1)
+	/* -path rewrites the cache in the background, -x starts the command */
+	if (pledge(daemonmode ? "stdio rpath wpath cpath unix proc exec" :
+	           execmode ? "stdio rpath wpath cpath proc exec" :
+	           pathmode || histfile ? "stdio rpath wpath cpath" : "stdio rpath", NULL) == -1)
 		die("pledge");
 #endif
 
-	if (fast && !isatty(0)) {
-		grabkeyboard();
-		readstdin();
-	} else {
-		readstdin();
-		grabkeyboard();
+	t = trace_begin();
+	setup();
+	trace_end("setup", t);
+	if (daemonmode) {
+		daemonrun();
+		return 1; /* unreachable */
 	}
 
-	if (casesensitive) {
-		fstrncmp = strncmp;
-		fstrstr = strstr;
+	if (fast && !isatty(0)) {
+		if (!grabkeyboard())
+			die("cannot grab keyboard");
+		pthread_join(reader, NULL);
 	} else {
-		fstrncmp = strncasecmp;
-		fstrstr = cistrstr;
+		pthread_join(reader, NULL);
+		if (!grabkeyboard())
+			die("cannot grab keyboard");
 	}
-	
-	setup();
+
+	checksnapshot();
+	openmenu();
+	savesnapshot();
 	run();
 
 	return 1; /* unreachable */
@@ -1262,6 +2205,10 @@ void xinitvisual() {
 
 	infos = XGetVisualInfo(dpy, masks, &tpl, &nitems);
 	visual = NULL;
+	/* the first XRenderFindVisualFormat() queries the extension and all
+	 * formats, later calls are answered from Xrender's cache */
+	if (nitems > 0)
+		roundtrips += 2;
 	for(i = 0; i < nitems; i ++) {
 		fmt = XRenderFindVisualFormat(dpy, infos[i].visual);
 		if (fmt->type == PictTypeDirect && fmt->direct.alphaMask) {
@@ -0,0 +1,84 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "arg.h"
+#include "path.h"
+#include "util.h"
+
+char *argv0;
+
+static void
+usage(void)
+{
+	die("usage: %s [-y beforechar] [-c manifest] [file]", argv0);
+}
+
+static int
+writeall(int fd, const char *buf, size_t n)
+{
+	ssize_t r;
+
+	while (n) {
+		if ((r = write(fd, buf, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		n -= r;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	PathDir *dirs;
+	char hpchar = '*', *list, *path, *manifest = NULL, tmp[PATH_MAX];
+	size_t n, len, stale;
+	int fd;
+
+	ARGBEGIN {
+	case 'c': /* only rescan directories changed since the manifest */
+		manifest = EARGF(usage());
+		break;
+	case 'y': /* marker for executables in local directories */
+		hpchar = EARGF(usage())[0];
+		break;
+	default:
+		usage();
+	} ARGEND;
+	if (argc > 1)
+		usage();
+
+	if (!(path = getenv("PATH")))
+		path = "";
+	dirs = path_dirs(path, &n);
+	stale = manifest ? path_load(dirs, n, manifest) : n;
+	if (stale)
+		path_scan(dirs, n);
+	if (manifest && stale && path_save(dirs, n, manifest) < 0)
+		die("cannot write %s:", manifest);
+	len = path_list(dirs, n, hpchar, &list);
+
+	if (argc) {
+		/* replace the file at once, readers never see half a list */
+		snprintf(tmp, sizeof tmp, "%s.%d", argv[0], (int)getpid());
+		if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0 ||
+		    writeall(fd, list, len) < 0 || close(fd) < 0 ||
+		    rename(tmp, argv[0]) < 0)
+			die("cannot write %s:", argv[0]);
+	}
+	if (writeall(STDOUT_FILENO, list, len) < 0)
+		die("write:");
+
+	free(list);
+	path_free(dirs, n);
+	return 0;
+}
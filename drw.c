@@ -1,15 +1,25 @@
 /* See LICENSE file for copyright and license details. */
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
+#include <X11/extensions/XShm.h>
 
 #include "drw.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define COVER_NONE  0xFF /* no font has the codepoint */
+#define FB_MAGIC    "dmenufb1"
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -37,6 +47,10 @@ static size_t utf8decode(const char* c, long int* u, size_t clen) {
 	*u = UTF_INVALID;
 	if (!clen)
 		return 0;
+	if (!((unsigned char)c[0] & 0x80)) {
+		*u = (unsigned char)c[0];
+		return 1;
+	}
 	udecoded = utf8decodebyte(c[0], &len);
 	if (!BETWEEN(len, 1, UTF_SIZ))
 		return 1;
@@ -53,6 +67,363 @@ static size_t utf8decode(const char* c, long int* u, size_t clen) {
 	return len;
 }
 
+/* DrwImage: the frame is composed here in an XImage, only the pixels that
+ * changed since the last drw_map() are sent, through MIT-SHM when the server
+ * can attach our memory */
+struct Img {
+	XImage *ximage;     /* NULL until drawn to after drw_resize() */
+	XShmSegmentInfo shm; /* shmaddr NULL without MIT-SHM */
+	uint32_t *shown;    /* the pixels the window was given last */
+	int fresh;          /* the window was given none yet */
+	int x0, y0, x1, y1; /* box drawn to since, empty if x0 >= x1 */
+};
+
+/* a glyph rasterized by FreeType, placed and advanced as Xft would */
+struct Glyph {
+	FT_UInt index;
+	int used;
+	int x, y, adv;    /* top left from the pen position, advance */
+	unsigned int w, h;
+	int bgra;         /* premultiplied color pixels, else coverage bytes */
+	unsigned char *bits;
+};
+
+static int shmfailed;
+
+static int shmerror(Display* dpy, XErrorEvent* ee) {
+	shmfailed = 1;
+	return 0;
+}
+
+static void imgfree(Drw* drw) {
+	struct Img *img = drw->img;
+
+	if (!img->ximage)
+		return;
+	if (img->shm.shmaddr) {
+		XShmDetach(drw->dpy, &img->shm);
+		img->ximage->data = NULL;
+		XDestroyImage(img->ximage);
+		shmdt(img->shm.shmaddr);
+		img->shm.shmaddr = NULL;
+	} else {
+		XDestroyImage(img->ximage);
+	}
+	img->ximage = NULL;
+	free(img->shown);
+	img->shown = NULL;
+}
+
+/* an image of the size of drw in memory the server attached, or in ours */
+static int imgcreate(Drw* drw) {
+	struct Img *img = drw->img;
+	int (*xerror)(Display *, XErrorEvent *);
+	union { uint32_t u; unsigned char c[4]; } endian = { 1 };
+	XImage *xi = NULL;
+	char *addr;
+
+#ifndef __OpenBSD__ /* pledge(2) has no SysV shared memory */
+	if (XShmQueryExtension(drw->dpy) &&
+	    (xi = XShmCreateImage(drw->dpy, drw->visual, drw->depth, ZPixmap, NULL,
+	                          &img->shm, drw->w, drw->h))) {
+		addr = (char *)-1;
+		if ((img->shm.shmid = shmget(IPC_PRIVATE, (size_t)xi->bytes_per_line * xi->height,
+		                             IPC_CREAT | 0600)) >= 0) {
+			if ((addr = shmat(img->shm.shmid, NULL, 0)) != (char *)-1) {
+				img->shm.shmaddr = xi->data = addr;
+				img->shm.readOnly = False;
+				/* a remote server cannot attach it */
+				shmfailed = 0;
+				xerror = XSetErrorHandler(shmerror);
+				XShmAttach(drw->dpy, &img->shm);
+				XSync(drw->dpy, False);
+				XSetErrorHandler(xerror);
+				if (shmfailed) {
+					shmdt(addr);
+					addr = (char *)-1;
+				}
+			}
+			/* gone once both sides detached */
+			shmctl(img->shm.shmid, IPC_RMID, NULL);
+		}
+		if (addr == (char *)-1) {
+			xi->data = NULL;
+			XDestroyImage(xi);
+			xi = NULL;
+		}
+	}
+#endif
+	img->shm.shmaddr = xi ? img->shm.shmaddr : NULL;
+	if (!xi && (xi = XCreateImage(drw->dpy, drw->visual, drw->depth, ZPixmap, 0, NULL,
+	                              drw->w, drw->h, 32, 0))) {
+		xi->data = ecalloc(xi->height, xi->bytes_per_line);
+		/* XPutImage() swaps the bytes if the server wants them otherwise */
+		xi->byte_order = endian.c[0] ? LSBFirst : MSBFirst;
+	}
+	img->ximage = xi;
+	if (!xi || xi->bits_per_pixel != 32) {
+		imgfree(drw);
+		return -1;
+	}
+	img->shown = ecalloc((size_t)drw->w * drw->h, sizeof(uint32_t));
+	img->fresh = 1;
+	img->x0 = img->y0 = img->x1 = img->y1 = 0;
+	return 0;
+}
+
+/* 1 if frames are composed in the image, made on first use; when it cannot
+ * be made the server draws */
+static int imgready(Drw* drw) {
+	if (!drw->img)
+		return 0;
+	if (!drw->img->ximage && imgcreate(drw) < 0) {
+		fputs("warning, cannot compose frames client side, drawing on the server\n", stderr);
+		free(drw->img);
+		drw->img = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+/* clip the box to the image and add it to the damage, 0 if nothing is left */
+static int imgdamage(Drw* drw, int* x, int* y, int* w, int* h) {
+	struct Img *img = drw->img;
+
+	if (*x < 0) {
+		*w += *x;
+		*x = 0;
+	}
+	if (*y < 0) {
+		*h += *y;
+		*y = 0;
+	}
+	*w = MIN(*w, img->ximage->width - *x);
+	*h = MIN(*h, img->ximage->height - *y);
+	if (*w <= 0 || *h <= 0)
+		return 0;
+	if (img->x0 >= img->x1) {
+		img->x0 = *x;
+		img->y0 = *y;
+		img->x1 = *x + *w;
+		img->y1 = *y + *h;
+	} else {
+		img->x0 = MIN(img->x0, *x);
+		img->y0 = MIN(img->y0, *y);
+		img->x1 = MAX(img->x1, *x + *w);
+		img->y1 = MAX(img->y1, *y + *h);
+	}
+	return 1;
+}
+
+static uint32_t* imgrow(Drw* drw, int y) {
+	return (uint32_t *)(drw->img->ximage->data + (size_t)y * drw->img->ximage->bytes_per_line);
+}
+
+static void imgfill(Drw* drw, int x, int y, int w, int h, unsigned long pixel) {
+	uint32_t *row;
+	int i, j;
+
+	if (!imgdamage(drw, &x, &y, &w, &h))
+		return;
+	for (j = y; j < y + h; j++)
+		for (row = imgrow(drw, j), i = x; i < x + w; i++)
+			row[i] = pixel;
+}
+
+/* Render's Over of the premultiplied s through coverage m onto d */
+static uint32_t over(uint32_t d, uint32_t s, unsigned int m) {
+	unsigned int sh, ia = 255 - ((s >> 24) * m + 127) / 255;
+	uint32_t r = 0;
+
+	for (sh = 0; sh < 32; sh += 8)
+		r |= (uint32_t)MIN(255, ((s >> sh & 0xff) * m + 127) / 255 +
+		                        ((d >> sh & 0xff) * ia + 127) / 255) << sh;
+	return r;
+}
+
+static FT_Int32 loadflags(FcPattern* p) {
+	FT_Int32 flags = FT_LOAD_DEFAULT;
+	FcBool b;
+	int style;
+
+	if (FcPatternGetBool(p, FC_ANTIALIAS, 0, &b) == FcResultMatch && !b)
+		flags |= FT_LOAD_TARGET_MONO;
+	else if (FcPatternGetInteger(p, FC_HINT_STYLE, 0, &style) == FcResultMatch && style == FC_HINT_SLIGHT)
+		flags |= FT_LOAD_TARGET_LIGHT;
+	if (FcPatternGetBool(p, FC_HINTING, 0, &b) == FcResultMatch && !b)
+		flags |= FT_LOAD_NO_HINTING;
+	if (FcPatternGetBool(p, FC_AUTOHINT, 0, &b) == FcResultMatch && b)
+		flags |= FT_LOAD_FORCE_AUTOHINT;
+	if (FcPatternGetBool(p, FC_EMBEDDED_BITMAP, 0, &b) == FcResultMatch && !b)
+		flags |= FT_LOAD_NO_BITMAP;
+#ifdef FT_LOAD_COLOR
+	flags |= FT_LOAD_COLOR;
+#endif
+	return flags;
+}
+
+/* Copy the rendered glyph into g, sampled to the box Xft gives it: a color
+ * bitmap font is scaled to the size asked for. */
+static void glyphbits(struct Glyph* g, FT_Bitmap* bm) {
+	unsigned int i, j, sx, sy, bpp;
+	unsigned char *src, *dst;
+
+	if (!g->w || !g->h || !bm->width || !bm->rows)
+		return;
+	g->bgra = bm->pixel_mode == FT_PIXEL_MODE_BGRA;
+	bpp = g->bgra ? 4 : 1;
+	g->bits = ecalloc((size_t)g->w * g->h, bpp);
+	for (j = 0; j < g->h; j++) {
+		sy = (unsigned long)j * bm->rows / g->h;
+		src = bm->buffer + (long)sy * bm->pitch;
+		for (i = 0; i < g->w; i++) {
+			sx = (unsigned long)i * bm->width / g->w;
+			dst = g->bits + ((size_t)j * g->w + i) * bpp;
+			if (bm->pixel_mode == FT_PIXEL_MODE_MONO)
+				*dst = src[sx / 8] & (0x80 >> sx % 8) ? 255 : 0;
+			else if (bm->pixel_mode == FT_PIXEL_MODE_GRAY)
+				*dst = src[sx] * 255 / MAX(bm->num_grays - 1, 1);
+			else if (g->bgra)
+				memcpy(dst, src + sx * 4, 4);
+		}
+	}
+}
+
+/* the glyph index of font f, rasterized on first use */
+static struct Glyph* glyph(Drw* drw, Fnt* f, FT_UInt index) {
+	struct Glyph *old, *g;
+	unsigned int i, n, mask;
+	FT_Int32 flags;
+	FT_Face face;
+	XGlyphInfo ext;
+
+	for (i = index, mask = f->glyphsiz - 1; f->glyphsiz && f->glyphs[i & mask].used; i++)
+		if (f->glyphs[i & mask].index == index)
+			return &f->glyphs[i & mask];
+	if ((f->nglyphs + 1) * 4 > f->glyphsiz * 3) {
+		old = f->glyphs;
+		n = f->glyphsiz;
+		f->glyphsiz = n ? n * 2 : 256;
+		f->glyphs = ecalloc(f->glyphsiz, sizeof(*f->glyphs));
+		for (mask = f->glyphsiz - 1; n--; )
+			if (old[n].used) {
+				for (i = old[n].index; f->glyphs[i & mask].used; i++)
+					;
+				f->glyphs[i & mask] = old[n];
+			}
+		free(old);
+	}
+	for (i = index, mask = f->glyphsiz - 1; f->glyphs[i & mask].used; i++)
+		;
+	g = &f->glyphs[i & mask];
+	g->used = 1;
+	g->index = index;
+	f->nglyphs++;
+
+	XftGlyphExtents(drw->dpy, f->xfont, &index, 1, &ext);
+	g->x = -ext.x;
+	g->y = -ext.y;
+	g->w = ext.width;
+	g->h = ext.height;
+	g->adv = ext.xOff;
+	/* a core font has no face, its glyphs stay blank */
+	if (!(face = XftLockFace(f->xfont)))
+		return g;
+	flags = loadflags(f->xfont->pattern);
+	if (!FT_Load_Glyph(face, index, flags) &&
+	    (face->glyph->format == FT_GLYPH_FORMAT_BITMAP ||
+	     !FT_Render_Glyph(face->glyph, FT_LOAD_TARGET_MODE(flags))))
+		glyphbits(g, &face->glyph->bitmap);
+	XftUnlockFace(f->xfont);
+	return g;
+}
+
+/* XftDrawStringUtf8() into the image */
+static void imgtext(Drw* drw, Fnt* f, Clr* clr, int x, int y, const char* s, int len) {
+	unsigned int a = clr->color.alpha >> 8, m;
+	uint32_t src, *row;
+	struct Glyph *g;
+	FcChar32 ucs4;
+	unsigned char *p;
+	int i, j, n, gx, gy, w, h;
+
+	src = a << 24 | (clr->color.red >> 8) * a / 255 << 16 |
+	      (clr->color.green >> 8) * a / 255 << 8 | (clr->color.blue >> 8) * a / 255;
+	for (; len > 0 && (n = FcUtf8ToUcs4((const FcChar8 *)s, &ucs4, len)) > 0; s += n, len -= n) {
+		g = glyph(drw, f, XftCharIndex(drw->dpy, f->xfont, ucs4));
+		gx = x + g->x;
+		gy = y + g->y;
+		w = g->w;
+		h = g->h;
+		x += g->adv;
+		if (!g->bits || !imgdamage(drw, &gx, &gy, &w, &h))
+			continue;
+		for (j = gy; j < gy + h; j++) {
+			row = imgrow(drw, j);
+			for (i = gx; i < gx + w; i++) {
+				p = g->bits + ((size_t)(j - y - g->y) * g->w + (i - x + g->adv - g->x)) * (g->bgra ? 4 : 1);
+				if (g->bgra)
+					row[i] = over(row[i], (uint32_t)p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0], 255);
+				else if ((m = *p))
+					row[i] = over(row[i], src, m);
+			}
+		}
+	}
+}
+
+static void imgput(Drw* drw, Window win, int x, int y, int w, int h) {
+	struct Img *img = drw->img;
+	int j;
+
+	if (img->shm.shmaddr)
+		XShmPutImage(drw->dpy, win, drw->gc, img->ximage, x, y, x, y, w, h, False);
+	else
+		XPutImage(drw->dpy, win, drw->gc, img->ximage, x, y, x, y, w, h);
+	for (j = y; j < y + h; j++)
+		memcpy(img->shown + (size_t)j * drw->w + x, imgrow(drw, j) + x, w * sizeof(uint32_t));
+}
+
+/* Send the part of the box that changed since the window was given it, in
+ * bands of rows that differ; with nothing drawn since, the window lost its
+ * contents and all of the box is sent. */
+static void imgmap(Drw* drw, Window win, int x, int y, unsigned int w, unsigned int h) {
+	struct Img *img = drw->img;
+	int x0 = MAX(x, 0), y0 = MAX(y, 0), x1 = MIN(x + (int)w, img->ximage->width);
+	int y1 = MIN(y + (int)h, img->ximage->height), j, l, r = 0, band = -1, bl = 0, br = 0;
+	uint32_t *row, *shown;
+
+	if (img->fresh || img->x0 >= img->x1) {
+		if (x0 < x1 && y0 < y1)
+			imgput(drw, win, x0, y0, x1 - x0, y1 - y0);
+		img->fresh = img->x0 = img->x1 = 0;
+		return;
+	}
+	x0 = MAX(x0, img->x0);
+	y0 = MAX(y0, img->y0);
+	x1 = MIN(x1, img->x1);
+	y1 = MIN(y1, img->y1);
+	img->x0 = img->x1 = 0;
+	for (j = y0; j <= y1; j++) {
+		l = x1;
+		if (j < y1) {
+			row = imgrow(drw, j);
+			shown = img->shown + (size_t)j * drw->w;
+			for (l = x0; l < x1 && row[l] == shown[l]; l++)
+				;
+			for (r = x1; r > l && row[r - 1] == shown[r - 1]; r--)
+				;
+		}
+		if (l < x1) {
+			bl = band < 0 ? l : MIN(bl, l);
+			br = band < 0 ? r : MAX(br, r);
+			band = band < 0 ? j : band;
+		} else if (band >= 0) {
+			imgput(drw, win, bl, band, br - bl, j - band);
+			band = -1;
+		}
+	}
+}
+
 Drw* drw_create(Display* dpy, int screen, Window root, unsigned int w, unsigned int h, Visual* visual, unsigned int depth, Colormap cmap) {
 	Drw* drw = ecalloc(1, sizeof(Drw));
 
@@ -80,15 +451,304 @@ void drw_resize(Drw* drw, unsigned int w, unsigned int h) {
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, drw->depth);
+	if (drw->img)
+		imgfree(drw);
+}
+
+static void forgetfallback(Drw* drw) {
+	size_t i;
+
+	for (i = 0; i < drw->nfallback; i++)
+		free(drw->fallback[i].name);
+	free(drw->fallback);
+	drw->fallback = NULL;
+	drw->nfallback = 0;
+}
+
+static int samefallback(const char* a, const char* b) {
+	return a == b || (a && b && !strcmp(a, b));
+}
+
+/* the range of fallbacks with u, NULL if fontconfig was never asked */
+static Fallback* findfallback(Drw* drw, long u) {
+	size_t lo = 0, hi = drw->nfallback, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (drw->fallback[mid].last < u)
+			lo = mid + 1;
+		else if (drw->fallback[mid].first > u)
+			hi = mid;
+		else
+			return &drw->fallback[mid];
+	}
+	return NULL;
+}
+
+/* remember the answer for u, merged into a neighbouring range of the same
+ * font; name is taken over */
+static void addfallback(Drw* drw, long u, char* name) {
+	Fallback *fb = drw->fallback;
+	size_t i, n = drw->nfallback;
+
+	for (i = 0; i < n && fb[i].first < u; i++)
+		;
+	drw->fallbackdirty = 1;
+	if (i > 0 && fb[i - 1].last + 1 == u && samefallback(fb[i - 1].name, name)) {
+		fb[i - 1].last = u;
+		if (i < n && fb[i].first == u + 1 && samefallback(fb[i].name, name)) {
+			fb[i - 1].last = fb[i].last;
+			free(fb[i].name);
+			memmove(fb + i, fb + i + 1, (n - i - 1) * sizeof(*fb));
+			drw->nfallback--;
+		}
+		free(name);
+		return;
+	}
+	if (i < n && fb[i].first == u + 1 && samefallback(fb[i].name, name)) {
+		fb[i].first = u;
+		free(name);
+		return;
+	}
+	if (!(fb = realloc(fb, (n + 1) * sizeof(*fb))))
+		die("cannot realloc %zu bytes:", (n + 1) * sizeof(*fb));
+	memmove(fb + i + 1, fb + i, (n - i) * sizeof(*fb));
+	fb[i].first = fb[i].last = u;
+	fb[i].name = name;
+	drw->fallback = fb;
+	drw->nfallback++;
+}
+
+/* the font fontconfig matched, as a string FcNameParse() gives back */
+static char* fallbackname(FcPattern* match) {
+	FcPattern *p;
+	char *name;
+
+	if (!(p = FcPatternDuplicate(match)))
+		return NULL;
+	/* the coverage is the font's to know, it would make the cache huge;
+	 * the size is the first font's, which is exact where %g is not */
+	FcPatternDel(p, FC_CHARSET);
+	FcPatternDel(p, FC_LANG);
+	FcPatternDel(p, FC_PIXEL_SIZE);
+	name = (char *)FcNameUnparse(p);
+	FcPatternDestroy(p);
+	if (name && strchr(name, '\n')) {
+		free(name);
+		name = NULL;
+	}
+	return name;
+}
+
+/* what the fallbacks were resolved for: the configured fonts and how the
+ * first was opened on this display, which includes its size and DPI */
+static unsigned long long fallbackkey(Drw* drw) {
+	unsigned long long h = 14695981039346656037ULL;
+	FcChar8 *name, *c;
+	Fnt *f;
+	int i;
+
+	/* fallbacks added on the way have no pattern of their own */
+	for (f = drw->fonts, i = 0; f; f = f->next, i++) {
+		if (!f->pattern || !(name = FcNameUnparse(i ? f->pattern : f->xfont->pattern)))
+			continue;
+		for (c = name; *c; c++)
+			h = (h ^ *c) * 1099511628211ULL;
+		h = (h ^ '\n') * 1099511628211ULL;
+		free(name);
+	}
+	return h;
+}
+
+/* Read the fallbacks fontconfig chose in earlier runs with the same font set
+ * from file: "first last name" per line, in hex, name "-" if no font had
+ * them. Returns -1 if there are none. */
+int drw_fallback_load(Drw* drw, const char* file) {
+	char *line = NULL, *name;
+	size_t siz = 0, n = 0;
+	unsigned long long key;
+	unsigned long first, last;
+	ssize_t len;
+	FILE *fp;
+	int pos;
+
+	if (!drw || !drw->fonts || !(fp = fopen(file, "r")))
+		return -1;
+	if (fscanf(fp, FB_MAGIC " %llx\n", &key) != 1 || key != fallbackkey(drw)) {
+		fclose(fp);
+		return -1;
+	}
+	forgetfallback(drw);
+	while ((len = getline(&line, &siz, fp)) > 0) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		if (sscanf(line, "%lx %lx %n", &first, &last, &pos) != 2 || first > last ||
+		    (n && first <= drw->fallback[n - 1].last))
+			break; /* the rest is damaged */
+		name = NULL;
+		if (strcmp(line + pos, "-") && !(name = strdup(line + pos)))
+			die("strdup:");
+		if (!(drw->fallback = realloc(drw->fallback, (n + 1) * sizeof(*drw->fallback))))
+			die("cannot realloc %zu bytes:", (n + 1) * sizeof(*drw->fallback));
+		drw->fallback[n].first = first;
+		drw->fallback[n].last = last;
+		drw->fallback[n++].name = name;
+	}
+	drw->nfallback = n;
+	drw->fallbackdirty = 0;
+	free(line);
+	fclose(fp);
+	return 0;
+}
+
+/* Write the fallbacks if there are new ones, replacing file at once.
+ * Returns -1 on error. */
+int drw_fallback_save(Drw* drw, const char* file) {
+	char tmp[PATH_MAX];
+	size_t i;
+	FILE *fp;
+	int err;
+
+	if (!drw || !drw->fallbackdirty)
+		return 0;
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid()) >= sizeof(tmp) ||
+	    !(fp = fopen(tmp, "w")))
+		return -1;
+	err = fprintf(fp, FB_MAGIC " %llx\n", fallbackkey(drw)) < 0;
+	for (i = 0; i < drw->nfallback && !err; i++)
+		err = fprintf(fp, "%lx %lx %s\n", drw->fallback[i].first, drw->fallback[i].last,
+		              drw->fallback[i].name ? drw->fallback[i].name : "-") < 0;
+	if (fclose(fp) || err || rename(tmp, file)) {
+		unlink(tmp);
+		return -1;
+	}
+	drw->fallbackdirty = 0;
+	return 0;
 }
 
 void drw_free(Drw* drw) {
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
+	free(drw->cover);
+	forgetfallback(drw);
+	if (drw->img)
+		imgfree(drw);
+	free(drw->img);
 	free(drw);
 }
 
+/* Draw frames with DrwServer, core and Render requests on a pixmap copied
+ * to the window, or DrwImage, composed here from the glyphs FreeType
+ * renders for the fonts and sent as the pixels that changed. Returns -1 if
+ * the visual has no 8 bit channels DrwImage can write. */
+int drw_setbackend(Drw* drw, int backend) {
+	Visual *v;
+
+	if (!drw)
+		return -1;
+	if (backend == DrwServer) {
+		if (drw->img)
+			imgfree(drw);
+		free(drw->img);
+		drw->img = NULL;
+		return 0;
+	}
+	v = drw->visual;
+	if ((drw->depth != 24 && drw->depth != 32) || v->class != TrueColor ||
+	    v->red_mask != 0xff0000 || v->green_mask != 0xff00 || v->blue_mask != 0xff)
+		return -1;
+	if (!drw->img)
+		drw->img = ecalloc(1, sizeof(struct Img));
+	return 0;
+}
+
+/* Forget which font has which codepoint; with all set, forget only the
+ * codepoints no font had, for a font was added. */
+static void uncover(Drw* drw, int all) {
+	unsigned int i;
+
+	if (drw->cover)
+		for (i = 0; i < 0x10000; i++)
+			if (all || drw->cover[i] == COVER_NONE)
+				drw->cover[i] = 0;
+	for (i = 0; i < LENGTH(drw->astral); i++)
+		if (all || drw->astral[i].font == COVER_NONE)
+			drw->astral[i].font = 0;
+}
+
+/* A font of the set after the first: only its name is parsed, opening it
+ * waits until xfont_open() is asked for a character the fonts before it
+ * do not have. */
+static Fnt* xfont_defer(Drw* drw, const char* fontname) {
+	FcPattern* pattern;
+	Fnt* font;
+
+	if (!(pattern = FcNameParse((FcChar8 *) fontname))) {
+		fprintf(stderr, "error, cannot parse font name to pattern: '%s'\n", fontname);
+		return NULL;
+	}
+	font = ecalloc(1, sizeof(Fnt));
+	font->name = fontname;
+	font->pattern = pattern;
+	font->dpy = drw->dpy;
+
+	return font;
+}
+
+static int xfont_open(Drw* drw, Fnt* font) {
+	if (font->xfont)
+		return 1;
+	if (!font->name)
+		return 0;
+	if (!(font->xfont = XftFontOpenName(drw->dpy, drw->screen, font->name))) {
+		fprintf(stderr, "error, cannot load font from name: '%s'\n", font->name);
+		font->name = NULL; /* do not try again */
+		return 0;
+	}
+	font->h = font->xfont->ascent + font->xfont->descent;
+	return 1;
+}
+
+/* the first font of the set with codepoint u, NULL if there is none */
+static Fnt* coverage(Drw* drw, long u) {
+	unsigned char *slot;
+	unsigned int i;
+	Fnt *f;
+
+	if (u < 0x10000) {
+		if (!drw->cover)
+			drw->cover = ecalloc(0x10000, 1);
+		slot = &drw->cover[u];
+	} else {
+		if (drw->nastral >= LENGTH(drw->astral) * 3 / 4) {
+			memset(drw->astral, 0, sizeof(drw->astral));
+			drw->nastral = 0;
+		}
+		for (i = ((unsigned int)u * 0x9E3779B1u) >> 24; drw->astral[i].u && drw->astral[i].u != u;
+		     i = (i + 1) % LENGTH(drw->astral))
+			;
+		if (!drw->astral[i].u) {
+			drw->astral[i].u = u;
+			drw->nastral++;
+		}
+		slot = &drw->astral[i].font;
+	}
+
+	if (*slot == COVER_NONE)
+		return NULL;
+	for (f = drw->fonts, i = 1; f && *slot; f = f->next, i++)
+		if (i == *slot)
+			return f;
+	for (f = drw->fonts, i = 1; f; f = f->next, i++)
+		if (xfont_open(drw, f) && XftCharExists(drw->dpy, f->xfont, u)) {
+			*slot = i < COVER_NONE ? i : 0;
+			return f;
+		}
+	*slot = COVER_NONE;
+	return NULL;
+}
+
 /* This function is an implementation detail. Library users should use
  * drw_fontset_create instead.
  */
@@ -131,27 +791,36 @@ static Fnt* xfont_create(Drw* drw, const char* fontname, FcPattern* fontpattern)
 }
 
 static void xfont_free(Fnt* font) {
+	unsigned int i;
+
 	if (!font)
 		return;
+	for (i = 0; i < font->glyphsiz; i++)
+		free(font->glyphs[i].bits);
+	free(font->glyphs);
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
-	XftFontClose(font->dpy, font->xfont);
+	if (font->xfont)
+		XftFontClose(font->dpy, font->xfont);
 	free(font);
 }
 
+/* Only the first font that loads is opened here, the others when a
+ * character needs them; the names have to stay valid until then. */
 Fnt* drw_fontset_create(Drw* drw, const char* fonts[], size_t fontcount) {
-	Fnt* cur, *ret = NULL;
+	Fnt* cur, *ret = NULL, **last = &ret;
 	size_t i;
 
 	if (!drw || !fonts)
 		return NULL;
 
-	for (i = 1; i <= fontcount; i++) {
-		if ((cur = xfont_create(drw, fonts[fontcount - i], NULL))) {
-			cur->next = ret;
-			ret = cur;
+	for (i = 0; i < fontcount; i++) {
+		if ((cur = ret ? xfont_defer(drw, fonts[i]) : xfont_create(drw, fonts[i], NULL))) {
+			*last = cur;
+			last = &cur->next;
 		}
 	}
+	uncover(drw, 1);
 	return (drw->fonts = ret);
 }
 
@@ -187,8 +856,10 @@ Clr *drw_scm_create(Drw* drw, const char* clrnames[], const unsigned int alphas[
 }
 
 void drw_setfontset(Drw* drw, Fnt* set) {
-	if (drw)
-		drw->fonts = set;
+	if (!drw)
+		return;
+	uncover(drw, 1);
+	drw->fonts = set;
 }
 
 void drw_setscheme(Drw* drw, Clr *scm) {
@@ -197,9 +868,23 @@ void drw_setscheme(Drw* drw, Clr *scm) {
 }
 
 void drw_rect(Drw* drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert) {
+	unsigned long pixel;
+
 	if (!drw || !drw->scheme)
 		return;
-	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
+	pixel = invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel;
+	if (imgready(drw)) {
+		if (filled) {
+			imgfill(drw, x, y, w, h, pixel);
+		} else {
+			imgfill(drw, x, y, w, 1, pixel);
+			imgfill(drw, x, y + h - 1, w, 1, pixel);
+			imgfill(drw, x, y, 1, h, pixel);
+			imgfill(drw, x + w - 1, y, 1, h, pixel);
+		}
+		return;
+	}
+	XSetForeground(drw->dpy, drw->gc, pixel);
 	if (filled)
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
 	else
@@ -218,15 +903,23 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 	FcPattern* fcpattern;
 	FcPattern* match;
 	XftResult result;
-	int charexists = 0, overflow = 0;
+	int charexists = 0, overflow = 0, tw;
+	Fallback *fb;
+	char *name;
+	double t, size;
 	/* keep track of a couple codepoints for which we have no match. */
 	static unsigned int nomatches[128], ellipsis_width;
 
+	stats_count(StatDrwText, 1);
 	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
 		return 0;
 
 	if (!render) {
 		w = invert ? invert : ~invert;
+	} else if (imgready(drw)) {
+		imgfill(drw, x, y, w, h, drw->scheme[invert ? ColFg : ColBg].pixel);
+		x += lpad;
+		w -= lpad;
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
@@ -235,6 +928,22 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 		w -= lpad;
 	}
 
+	/* printable ASCII the first font has is a single run, measured from
+	 * the advances of the font without looking at each character */
+	if ((tw = drw_fontset_getwidth_ascii(drw, text)) >= 0 && tw <= w) {
+		if (!render)
+			return tw;
+		ty = y + (h - drw->fonts->h) / 2 + drw->fonts->xfont->ascent;
+		if (!d) {
+			imgtext(drw, drw->fonts, &drw->scheme[invert ? ColBg : ColFg], x, ty, text, strlen(text));
+			return x + w;
+		}
+		XftDrawString8(d, &drw->scheme[invert ? ColBg : ColFg], drw->fonts->xfont,
+		               x, ty, (XftChar8 *)text, strlen(text));
+		XftDrawDestroy(d);
+		return x + w;
+	}
+
 	usedfont = drw->fonts;
 	if (!ellipsis_width && render)
 		ellipsis_width = drw_fontset_getwidth(drw, "…");
@@ -244,34 +953,37 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 		nextfont = NULL;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
+			/* one that no font has is drawn in the first */
+			curfont = charexists ? drw->fonts : coverage(drw, utf8codepoint);
+			charexists = curfont != NULL;
+			if (curfont) {
+				if (utf8codepoint < LENGTH(curfont->ascii) && curfont->hasascii &&
+				    curfont->ascii[utf8codepoint] >= 0)
+					tmpw = curfont->ascii[utf8codepoint];
+				else
 					drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
-					if (ew + ellipsis_width <= w) {
-						/* keep track where the ellipsis still fits */
-						ellipsis_x = x + ew;
-						ellipsis_w = w - ew;
-						ellipsis_len = utf8strlen;
-					}
+				if (ew + ellipsis_width <= w) {
+					/* keep track where the ellipsis still fits */
+					ellipsis_x = x + ew;
+					ellipsis_w = w - ew;
+					ellipsis_len = utf8strlen;
+				}
 
-					if (ew + tmpw > w) {
-						overflow = 1;
-						/* called from drw_fontset_getwidth_clamp():
-						 * it wants the width AFTER the overflow
-						 */
-						if (!render)
-							x += tmpw;
-						else
-							utf8strlen = ellipsis_len;
-					} else if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-						ew += tmpw;
-					} else {
-						nextfont = curfont;
-					}
-					break;
+				if (ew + tmpw > w) {
+					overflow = 1;
+					/* called from drw_fontset_getwidth_clamp():
+					 * it wants the width AFTER the overflow
+					 */
+					if (!render)
+						x += tmpw;
+					else
+						utf8strlen = ellipsis_len;
+				} else if (curfont == usedfont) {
+					utf8strlen += utf8charlen;
+					text += utf8charlen;
+					ew += tmpw;
+				} else {
+					nextfont = curfont;
 				}
 			}
 
@@ -284,8 +996,12 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 		if (utf8strlen) {
 			if (render) {
 				ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-				XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-				                  usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
+				if (d)
+					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
+					                  usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
+				else
+					imgtext(drw, usedfont, &drw->scheme[invert ? ColBg : ColFg],
+					        x, ty, utf8str, utf8strlen);
 			}
 			x += ew;
 			w -= ew;
@@ -312,6 +1028,20 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 			if (nomatches[h0] == utf8codepoint || nomatches[h1] == utf8codepoint)
 				goto no_match;
 
+			/* fontconfig was asked in an earlier run */
+			name = NULL;
+			match = NULL;
+			if ((fb = findfallback(drw, utf8codepoint))) {
+				if (!fb->name)
+					goto no_match;
+				if ((match = FcNameParse((FcChar8 *)fb->name))) {
+					if (FcPatternGetDouble(drw->fonts->xfont->pattern, FC_PIXEL_SIZE, 0, &size) == FcResultMatch)
+						FcPatternAddDouble(match, FC_PIXEL_SIZE, size);
+					goto open;
+				}
+			}
+
+			t = trace_begin();
 			fccharset = FcCharSetCreate();
 			FcCharSetAddChar(fccharset, utf8codepoint);
 
@@ -330,16 +1060,32 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 
 			FcCharSetDestroy(fccharset);
 			FcPatternDestroy(fcpattern);
-
+			trace_arg("fontfallback", t, utf8codepoint);
+			if (match)
+				name = fallbackname(match);
+			else
+				addfallback(drw, utf8codepoint, NULL);
+open:
 			if (match) {
 				usedfont = xfont_create(drw, NULL, match);
 				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
 					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
 						; /* NOP */
 					curfont->next = usedfont;
+					uncover(drw, 0); /* it may have what none had */
+					if (!fb && name)
+						addfallback(drw, utf8codepoint, name);
 				} else {
 					xfont_free(usedfont);
-					nomatches[nomatches[h0] ? h1 : h0] = utf8codepoint;
+					if (fb) {
+						/* the font changed or is gone, ask fontconfig again */
+						forgetfallback(drw);
+						drw->fallbackdirty = 1;
+					} else {
+						free(name);
+						addfallback(drw, utf8codepoint, NULL);
+						nomatches[nomatches[h0] ? h1 : h0] = utf8codepoint;
+					}
 no_match:
 					usedfont = drw->fonts;
 				}
@@ -353,11 +1099,18 @@ no_match:
 }
 
 void drw_map(Drw* drw, Window win, int x, int y, unsigned int w, unsigned int h) {
+	double t = stats_start();
+
 	if (!drw)
 		return;
 
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
+	if (drw->img && drw->img->ximage)
+		imgmap(drw, win, x, y, w, h);
+	else
+		XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
+	/* the server is done reading shared memory drawn to next */
 	XSync(drw->dpy, False);
+	stats_time(StatDrwMap, t);
 }
 
 unsigned int drw_fontset_getwidth(Drw* drw, const char* text) {
@@ -373,6 +1126,36 @@ unsigned int drw_fontset_getwidth_clamp(Drw* drw, const char* text, unsigned int
 	return MIN(n, tmp);
 }
 
+/* The width of text if it is printable ASCII the first font has, -1 if it
+ * is not. The advances are asked for once, so this costs no round trip
+ * and no Xft call per string. */
+int drw_fontset_getwidth_ascii(Drw* drw, const char* text) {
+	const unsigned char *s;
+	XGlyphInfo ext;
+	FcChar8 c;
+	Fnt *f;
+	int w = 0;
+
+	if (!drw || !(f = drw->fonts) || !text)
+		return -1;
+	if (!f->hasascii) {
+		for (c = 0; c < LENGTH(f->ascii); c++) {
+			f->ascii[c] = -1;
+			if (c >= ' ' && c < 0x7f && XftCharExists(f->dpy, f->xfont, c)) {
+				XftTextExtents8(f->dpy, f->xfont, &c, 1, &ext);
+				f->ascii[c] = ext.xOff;
+			}
+		}
+		f->hasascii = 1;
+	}
+	for (s = (const unsigned char *)text; *s; s++) {
+		if (*s >= LENGTH(f->ascii) || f->ascii[*s] < 0)
+			return -1;
+		w += f->ascii[*s];
+	}
+	return w;
+}
+
 void drw_font_getexts(Fnt* font, const char* text, unsigned int len, unsigned int *w, unsigned int *h) {
 	XGlyphInfo ext;
 
@@ -7,14 +7,26 @@ typedef struct {
 typedef struct Fnt {
 	Display *dpy;
 	unsigned int h;
-	XftFont *xfont;
+	XftFont *xfont;   /* NULL until the font is needed, see xfont_open() */
+	const char *name; /* to open it by, NULL if that failed */
 	FcPattern *pattern;
+	int ascii[128]; /* advance of each printable character, -1 if missing */
+	int hasascii;   /* ascii[] was filled */
+	struct Glyph *glyphs; /* rasterized for DrwImage, hashed by index */
+	unsigned int nglyphs, glyphsiz;
 	struct Fnt *next;
 } Fnt;
 
 enum { ColFg, ColBg }; /* Clr scheme index */
+enum { DrwServer, DrwImage }; /* how frames are drawn, see drw_setbackend() */
 typedef XftColor Clr;
 
+/* the font fontconfig chose for a range of codepoints missing in the set */
+typedef struct {
+	long first, last;
+	char *name; /* FcNameUnparse() of the font, NULL if there was none */
+} Fallback;
+
 typedef struct {
 	unsigned int w, h;
 	Display *dpy;
@@ -27,18 +39,31 @@ typedef struct {
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	/* the font each codepoint is drawn in, 1 + its index in fonts, 0 if
+	 * not known yet: a table for the BMP and a small hash for the rest */
+	unsigned char *cover;
+	struct { long u; unsigned char font; } astral[256];
+	unsigned int nastral;
+	Fallback *fallback; /* sorted, see drw_fallback_load() */
+	size_t nfallback;
+	int fallbackdirty;
+	struct Img *img; /* the frame composed here, NULL for DrwServer */
 } Drw;
 
 /* Drawable abstraction */
 Drw *drw_create(Display *dpy, int screen, Window win, unsigned int w, unsigned int h, Visual*, unsigned int, Colormap);
 void drw_resize(Drw *drw, unsigned int w, unsigned int h);
 void drw_free(Drw *drw);
+int drw_setbackend(Drw *drw, int backend);
 
 /* Fnt abstraction */
 Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
 void drw_fontset_free(Fnt* set);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 unsigned int drw_fontset_getwidth_clamp(Drw *drw, const char *text, unsigned int n);
+int drw_fontset_getwidth_ascii(Drw *drw, const char *text);
+int drw_fallback_load(Drw *drw, const char *file);
+int drw_fallback_save(Drw *drw, const char *file);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
 
 /* Colorscheme abstraction */
@@ -0,0 +1,147 @@
+/* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frecency.h"
+#include "util.h"
+
+#define MAGIC    "dmenufr1"
+#define HALFLIFE (7 * 24 * 3600.0) /* seconds */
+#define MINSLOTS 64
+#define FORGET   0.05 /* hits decayed below this are dropped */
+
+/* the file is the magic, the number of slots, a power of two, then them */
+typedef struct {
+	uint64_t hash; /* 0 is a free slot */
+	double hits;   /* as of time */
+	int64_t time;
+} Slot;
+
+struct Frecency {
+	void *map;
+	size_t maplen;
+	const Slot *slots;
+	uint64_t mask;
+	int64_t now;
+};
+
+static uint64_t hash(const char *s) {
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+	return h ? h : 1;
+}
+
+static double decay(const Slot *s, int64_t now) {
+	return s->hits * exp2(-(double)(now - s->time) / HALFLIFE);
+}
+
+/* Map the table in file, NULL if it does not exist or is not one. */
+Frecency *frecency_open(const char *file) {
+	Frecency *f;
+	struct stat st;
+	uint64_t nslots;
+	void *map;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(MAGIC) - 1 + sizeof(nslots) ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	memcpy(&nslots, (char *)map + sizeof(MAGIC) - 1, sizeof(nslots));
+	if (memcmp(map, MAGIC, sizeof(MAGIC) - 1) || !nslots || (nslots & (nslots - 1)) ||
+	    nslots > (st.st_size - sizeof(MAGIC) + 1 - sizeof(nslots)) / sizeof(Slot) ||
+	    st.st_size != sizeof(MAGIC) - 1 + sizeof(nslots) + nslots * sizeof(Slot)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	f = ecalloc(1, sizeof(*f));
+	f->map = map;
+	f->maplen = st.st_size;
+	f->slots = (const Slot *)((char *)map + sizeof(MAGIC) - 1 + sizeof(nslots));
+	f->mask = nslots - 1;
+	f->now = time(NULL);
+	return f;
+}
+
+/* the decayed number of times text was selected */
+double frecency_get(const Frecency *f, const char *text) {
+	uint64_t h = hash(text), i, n;
+
+	for (i = h & f->mask, n = 0; n <= f->mask && f->slots[i].hash; i = (i + 1) & f->mask, n++)
+		if (f->slots[i].hash == h)
+			return decay(&f->slots[i], f->now);
+	return 0;
+}
+
+void frecency_close(Frecency *f) {
+	if (!f)
+		return;
+	munmap(f->map, f->maplen);
+	free(f);
+}
+
+static void put(Slot *slots, uint64_t mask, uint64_t h, double hits, int64_t now) {
+	uint64_t i;
+
+	for (i = h & mask; slots[i].hash && slots[i].hash != h; i = (i + 1) & mask)
+		;
+	slots[i].hash = h;
+	slots[i].hits += hits;
+	slots[i].time = now;
+}
+
+/* Count a selection of text, rewriting the table in file and replacing it
+ * at once so readers see either table whole. Returns -1 on error. */
+int frecency_hit(const char *file, const char *text) {
+	Frecency *f = frecency_open(file);
+	char tmp[PATH_MAX];
+	int64_t now = time(NULL);
+	uint64_t i, nslots = MINSLOTS, live = 1;
+	Slot *slots;
+	FILE *fp;
+	int err;
+
+	if (f)
+		for (i = 0; i <= f->mask; i++)
+			live += f->slots[i].hash && decay(&f->slots[i], now) >= FORGET;
+	/* at most three quarters full */
+	while (nslots * 3 < live * 4)
+		nslots <<= 1;
+	slots = ecalloc(nslots, sizeof(*slots));
+	if (f)
+		for (i = 0; i <= f->mask; i++)
+			if (f->slots[i].hash && decay(&f->slots[i], now) >= FORGET)
+				put(slots, nslots - 1, f->slots[i].hash, decay(&f->slots[i], now), now);
+	frecency_close(f);
+	put(slots, nslots - 1, hash(text), 1, now);
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid()) >= sizeof(tmp) ||
+	    !(fp = fopen(tmp, "w"))) {
+		free(slots);
+		return -1;
+	}
+	err = fwrite(MAGIC, 1, sizeof(MAGIC) - 1, fp) != sizeof(MAGIC) - 1 ||
+	      fwrite(&nslots, sizeof(nslots), 1, fp) != 1 ||
+	      fwrite(slots, sizeof(*slots), nslots, fp) != nslots;
+	free(slots);
+	if (fclose(fp) || err || rename(tmp, file)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,10 @@
+/* See LICENSE file for copyright and license details. */
+
+/* How often and how lately each text was selected, kept in a file that
+ * holds an open addressing hash table; selections count half after a week */
+typedef struct Frecency Frecency;
+
+Frecency *frecency_open(const char *file);
+double frecency_get(const Frecency *f, const char *text);
+void frecency_close(Frecency *f);
+int frecency_hit(const char *file, const char *text);
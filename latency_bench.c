@@ -0,0 +1,353 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <X11/extensions/Xdamage.h>
+
+#include "arg.h"
+#include "util.h"
+
+/* Experimental: written against the XTest and Damage documentation but not
+ * yet run on an Xvfb, its numbers are unverified. */
+
+#define TIMEOUT    1000 /* ms a key may take to show up on screen */
+#define QUIET      30   /* ms without damage before the next key */
+#define MAXSAMPLES 8192
+
+/* a dmenu invocation and the keys pressed in it, space separated: a single
+ * character is typed as itself, anything else is a keysym name, "ctrl+"
+ * holds Control */
+typedef struct {
+	const char *name;
+	const char *args[8];
+	const char *keys;
+} Workload;
+
+static const Workload workloads[] = {
+	{ "typing", { NULL },
+	  "f i r e BackSpace BackSpace BackSpace BackSpace t e r m BackSpace "
+	  "BackSpace BackSpace BackSpace x t BackSpace BackSpace" },
+	{ "grid",   { "-l", "10", "-g", "4", NULL },
+	  "Down Down Right Right Right Down Left Left Up Up Right Down Down Left Up" },
+	{ "paging", { "-l", "20", NULL },
+	  "Next Next Next Prior Next Next Prior Prior End Home" },
+	{ "tab",    { NULL },
+	  "/ u s Tab l i Tab BackSpace BackSpace BackSpace BackSpace BackSpace "
+	  "BackSpace BackSpace BackSpace BackSpace" },
+	{ "paste",  { NULL },
+	  "ctrl+y ctrl+u ctrl+y ctrl+u ctrl+y ctrl+u ctrl+y ctrl+u" },
+};
+
+static const char *syllables[] = {
+	"fi", "re", "fox", "term", "in", "al", "x", "ed", "it", "or", "mu", "sic",
+	"vi", "de", "o", "net", "work", "ma", "nag", "er", "py", "thon", "gi", "mp",
+};
+
+static const char *pastetext = "pasted from the benchmark";
+
+char *argv0;
+static Display *dpy;
+static Window owner;
+static Atom utf8;
+static int damageev, image, nlines = 20000, repeats = 5;
+static pid_t xvfb;
+
+static void
+usage(void)
+{
+	die("usage: %s [-i] [-n lines] [-r repeats] dmenu", argv0);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int
+xerror(Display *d, XErrorEvent *ee)
+{
+	/* the menu window goes away while it is still watched */
+	return 0;
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* hand our PRIMARY selection to dmenu's paste */
+static void
+answer(XSelectionRequestEvent *req)
+{
+	XEvent ev = { .xselection = {
+		.type = SelectionNotify, .requestor = req->requestor,
+		.selection = req->selection, .target = req->target,
+		.property = None, .time = req->time,
+	} };
+
+	if (req->target == utf8 || req->target == XA_STRING) {
+		XChangeProperty(dpy, req->requestor, req->property, req->target, 8,
+		                PropModeReplace, (unsigned char *)pastetext, strlen(pastetext));
+		ev.xselection.property = req->property;
+	}
+	XSendEvent(dpy, req->requestor, False, NoEventMask, &ev);
+	XFlush(dpy);
+}
+
+/* wait up to ms for the next event of type, or for damage if type is 0;
+ * returns 1 if it came and stores it in ev */
+static int
+waitfor(int type, int ms, XEvent *ev)
+{
+	struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+	double end = now() + ms;
+	int left;
+
+	for (;;) {
+		while (XPending(dpy)) {
+			XNextEvent(dpy, ev);
+			if (ev->type == SelectionRequest)
+				answer(&ev->xselectionrequest);
+			else if (type ? ev->type == type : ev->type == damageev + XDamageNotify)
+				return 1;
+		}
+		if ((left = end - now()) <= 0)
+			return 0;
+		poll(&pfd, 1, left);
+	}
+}
+
+/* wait up to ms for dmenu to draw to its window, -1 if it did not */
+static int
+frame(Damage damage, int ms)
+{
+	XEvent ev;
+
+	if (!waitfor(0, ms, &ev))
+		return -1;
+	XDamageSubtract(dpy, damage, None, None);
+	return 0;
+}
+
+/* swallow the frames still coming, like the one for a key release */
+static void
+settle(Damage damage)
+{
+	while (frame(damage, QUIET) >= 0)
+		;
+}
+
+static void
+key(const char *name, int press)
+{
+	KeySym sym = name[1] ? XStringToKeysym(name) : (KeySym)(unsigned char)name[0];
+	KeyCode code;
+
+	if (sym == NoSymbol || !(code = XKeysymToKeycode(dpy, sym)))
+		die("no key for %s", name);
+	XTestFakeKeyEvent(dpy, code, press, CurrentTime);
+}
+
+static pid_t
+spawn(const Workload *w, const char *dmenu)
+{
+	const char *argv[LENGTH(w->args) + 3] = { dmenu };
+	char line[64];
+	FILE *fp;
+	pid_t pid;
+	int fd[2], i, j, n;
+
+	for (i = 0; w->args[i]; i++)
+		argv[i + 1] = w->args[i];
+	if (image)
+		argv[i + 1] = "-image";
+	if (pipe(fd) < 0)
+		die("pipe:");
+	switch ((pid = fork())) {
+	case -1:
+		die("fork:");
+	case 0:
+		dup2(fd[0], 0);
+		close(fd[0]);
+		close(fd[1]);
+		execv(dmenu, (char **)argv);
+		die("cannot exec %s:", dmenu);
+	}
+	close(fd[0]);
+	if (!(fp = fdopen(fd[1], "w")))
+		die("fdopen:");
+	/* the same pseudo random names every time */
+	srand(1);
+	for (i = 0; i < nlines; i++) {
+		for (j = 0, n = 1 + rand() % 4, line[0] = '\0'; j < n; j++)
+			strcat(line, syllables[rand() % LENGTH(syllables)]);
+		fprintf(fp, "%s%s\n", line, i % 3 ? "" : "-bin");
+	}
+	fclose(fp);
+	return pid;
+}
+
+static void
+run(const Workload *w, const char *dmenu, double *lat, int *n, double *start, int *nstart, int *missed)
+{
+	Damage damage;
+	XEvent ev;
+	char keys[256], *k, *sym;
+	double t;
+	pid_t pid;
+	int ctrl;
+
+	t = now();
+	pid = spawn(w, dmenu);
+	/* the menu is the first window mapped after the keyboard grab */
+	if (!waitfor(MapNotify, 10000, &ev))
+		die("%s: dmenu did not map a window", w->name);
+	damage = XDamageCreate(dpy, ev.xmap.window, XDamageReportNonEmpty);
+	if (frame(damage, TIMEOUT) >= 0)
+		start[(*nstart)++] = now() - t;
+	settle(damage);
+
+	snprintf(keys, sizeof keys, "%s", w->keys);
+	for (k = strtok(keys, " "); k && *n < MAXSAMPLES; k = strtok(NULL, " ")) {
+		if ((ctrl = !strncmp(k, "ctrl+", 5))) {
+			key("Control_L", True);
+			XSync(dpy, False);
+			settle(damage);
+		}
+		sym = ctrl ? k + 5 : k;
+		t = now();
+		key(sym, True);
+		XSync(dpy, False);
+		if (frame(damage, TIMEOUT) >= 0)
+			lat[(*n)++] = now() - t;
+		else
+			(*missed)++;
+		key(sym, False);
+		if (ctrl)
+			key("Control_L", False);
+		XSync(dpy, False);
+		settle(damage);
+	}
+
+	XDamageDestroy(dpy, damage);
+	key("Escape", True);
+	key("Escape", False);
+	XSync(dpy, False);
+	waitpid(pid, NULL, 0);
+}
+
+static void
+report(const char *name, double *lat, int n, int missed)
+{
+	double sum = 0;
+	int i;
+
+	if (!n) {
+		printf("%-8s %5d %9s %9s %9s %9s %9s %6d\n", name, 0, "-", "-", "-", "-", "-", missed);
+		return;
+	}
+	qsort(lat, n, sizeof(*lat), cmpdouble);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	printf("%-8s %5d %9.3f %9.3f %9.3f %9.3f %9.3f %6d\n", name, n, lat[n / 2],
+	       lat[n * 90 / 100], lat[n * 99 / 100], lat[n - 1], sum / n, missed);
+}
+
+/* start Xvfb on a free display, it writes the number to fd when ready */
+static void
+startx(void)
+{
+	char fdstr[16], name[32];
+	ssize_t len;
+	int fd[2];
+
+	if (pipe(fd) < 0)
+		die("pipe:");
+	snprintf(fdstr, sizeof fdstr, "%d", fd[1]);
+	switch ((xvfb = fork())) {
+	case -1:
+		die("fork:");
+	case 0:
+		close(fd[0]);
+		execlp("Xvfb", "Xvfb", "-displayfd", fdstr, "-screen", "0", "1280x800x24",
+		       "-nolisten", "tcp", (char *)NULL);
+		die("cannot exec Xvfb:");
+	}
+	close(fd[1]);
+	name[0] = ':';
+	if ((len = read(fd[0], name + 1, sizeof name - 2)) <= 0)
+		die("Xvfb did not start");
+	close(fd[0]);
+	name[len + 1] = '\0';
+	name[strcspn(name, "\n")] = '\0';
+	if (setenv("DISPLAY", name, 1) < 0 || !(dpy = XOpenDisplay(name)))
+		die("cannot open display %s", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static double lat[MAXSAMPLES], start[MAXSAMPLES];
+	int i, r, n, nstart = 0, missed, ev, err, major, minor;
+
+	ARGBEGIN {
+	case 'i': /* dmenu composes its frames client side */
+		image = 1;
+		break;
+	case 'n':
+		nlines = atoi(EARGF(usage()));
+		break;
+	case 'r':
+		repeats = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	} ARGEND;
+	if (argc != 1 || repeats < 1)
+		usage();
+
+	startx();
+	XSetErrorHandler(xerror);
+	if (!XTestQueryExtension(dpy, &ev, &err, &major, &minor))
+		die("no XTest extension");
+	if (!XDamageQueryExtension(dpy, &damageev, &err))
+		die("no Damage extension");
+	utf8 = XInternAtom(dpy, "UTF8_STRING", False);
+	XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureNotifyMask);
+	owner = XCreateSimpleWindow(dpy, DefaultRootWindow(dpy), 0, 0, 1, 1, 0, 0, 0);
+	XSetSelectionOwner(dpy, XA_PRIMARY, owner, CurrentTime);
+
+	printf("%-8s %5s %9s %9s %9s %9s %9s %6s\n", "workload", "keys", "p50 ms",
+	       "p90 ms", "p99 ms", "max ms", "mean ms", "missed");
+	for (i = 0; i < LENGTH(workloads); i++) {
+		for (r = n = missed = 0; r < repeats; r++)
+			run(&workloads[i], argv[0], lat, &n, start, &nstart, &missed);
+		report(workloads[i].name, lat, n, missed);
+		fflush(stdout);
+	}
+	/* spawn to first frame, over all runs */
+	report("startup", start, nstart, LENGTH(workloads) * repeats - nstart);
+
+	XCloseDisplay(dpy);
+	kill(xvfb, SIGTERM);
+	waitpid(xvfb, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,429 @@
+/* See LICENSE file for copyright and license details. */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "match.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+/* bitmask of the case folded bytes in s, an item can only match a search
+ * whose signature is a subset of its own */
+uint64_t match_signature(const char *s) {
+	uint64_t sig = 0;
+	unsigned char c;
+
+	for (; (c = *s); s++) {
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		if (c >= 'a' && c <= 'z')
+			sig |= 1ULL << (c - 'a');
+		else if (c >= '0' && c <= '9')
+			sig |= 1ULL << (26 + c - '0');
+		else if (c >= 0x80)
+			sig |= 1ULL << 36;
+		else
+			sig |= 1ULL << (37 + c % 27);
+	}
+	return sig;
+}
+
+void match_append(struct item *item, struct item **list, struct item **last) {
+	if (*last)
+		(*last)->right = item;
+	else
+		*list = item;
+	item->left = *last;
+	item->right = NULL;
+	*last = item;
+}
+
+static char *cistrstr(const char *h, const char *n) {
+	size_t i;
+	if (!n[0]) return (char *)h;
+	for (/* empty */; *h; ++h) {
+		for (i = 0; n[i] && tolower((unsigned char)n[i]) == tolower((unsigned char)h[i]); ++i) {}
+		if (n[i] == '\0')
+			return (char *)h;
+	}
+	return NULL;
+}
+
+static int compare_distance(const void *a, const void *b) {
+	struct item *da = *(struct item **) a;
+	struct item *db = *(struct item **) b;
+	if (!db) return 1;
+	if (!da) return -1;
+	return da->distance == db->distance ? 0 : da->distance < db->distance ? -1 : 1;
+}
+
+/* what the greedy walk of a fuzzy match took, the score is made of it */
+typedef struct {
+	int match, matchci, matchdis, matchcontinuous;
+} Walk;
+
+/* Take each byte of text that is the next byte of search, setting mask for
+ * it unless mask is NULL. Returns 1 if all of search was taken. */
+static inline int walk(const MatchConf *conf, const char *search, const char *text, Walk *w, unsigned char *mask) {
+	const char *c;
+	int i = 0, j = 0, continuous = 0;
+	/* locals, mask could alias *w */
+	int match = 0, matchci = 0, matchdis = 0, matchcontinuous = 0;
+
+	for (c = text; *c; ++c, ++j) {
+		if (search[i] == *c) {
+			match += 1; matchci += 1;
+			matchdis += j;
+		} else if (!conf->casesensitive &&
+		           tolower((unsigned char)search[i]) == tolower((unsigned char)*c)) {
+			matchci += 1;
+			matchdis += j;
+		} else {
+			matchcontinuous += continuous;
+			continuous = 0;
+			++j;
+			continue;
+		}
+		if (mask)
+			mask[c - text] = 1;
+		++continuous;
+		++i; ++j;
+	}
+	w->match = match;
+	w->matchci = matchci;
+	w->matchdis = matchdis;
+	w->matchcontinuous = matchcontinuous + continuous;
+	return search[i] == '\0';
+}
+
+/* Append every item of list matching search, scored into its distance.
+ * path is set when a path is being completed. Returns the number of
+ * items appended. */
+size_t match_fuzzy(const MatchConf *conf, const char *search, int path, struct item *list, struct item **matches, struct item **matchend) {
+	struct item *it;
+	Walk w;
+	size_t n = 0, rejected = 0;
+	int search_len = strlen(search);
+	uint64_t sig = match_signature(search);
+
+	for (it = list; it && it->text; ++it) {
+		it->distance = 0;
+		if (search_len) {
+			/* turned away without looking at the text */
+			if (search_len > it->len || (sig & ~it->sig)) {
+				rejected++;
+				continue;
+			}
+			if (!walk(conf, search, it->text, &w, NULL)) continue;
+			it->distance += (float)w.match * conf->letter;
+			it->distance += (float)w.matchci * conf->letterci;
+			it->distance += (float)w.matchcontinuous * conf->continuous;
+			if (w.matchci > 0) it->distance -= (float)w.matchdis * conf->nearstart;
+			if (w.match == it->len) it->distance += conf->exact;
+			if (w.matchci == it->len) it->distance += conf->close;
+		}
+		if (it->hp) it->distance += conf->hp;
+		it->distance += it->bonus;
+		if (it->file) it->distance += it->folder ? conf->folder : conf->file;
+		if (it->file && path) it->distance += conf->path;
+		match_append(it, matches, matchend);
+		n++;
+	}
+	stats_count(StatScanned, it - list);
+	stats_count(StatRejected, rejected);
+	return n;
+}
+
+/* Set mask[i] for every byte i of text the match put there: for fuzzy
+ * matching the bytes walk() took for search, as scored by match_fuzzy(), for
+ * -F the first occurrence of each token. mask holds strlen(text) bytes. */
+void match_positions(const MatchConf *conf, int fuzzy, const char *search, const char *text, unsigned char *mask) {
+	char *(*fstrstr)(const char *, const char *) = conf->casesensitive ? strstr : cistrstr;
+	char buf[BUFSIZ], *tok, *hit;
+	Walk w;
+
+	memset(mask, 0, strlen(text));
+	if (fuzzy) {
+		walk(conf, search, text, &w, mask);
+		return;
+	}
+	snprintf(buf, sizeof buf, "%s", search);
+	for (tok = strtok(buf, " "); tok; tok = strtok(NULL, " "))
+		if ((hit = fstrstr(text, tok)))
+			memset(mask + (hit - text), 1, strlen(tok));
+}
+
+/* sort the n matches by distance */
+void match_rank(struct item **matches, struct item **matchend, size_t n) {
+	/* bang - we have so much memory */
+	struct item *it;
+	struct item **fuzzymatches = NULL;
+	size_t i;
+	double t, tr;
+
+	if (!n)
+		return;
+	t = stats_start();
+	tr = trace_begin();
+	/* initialize array with matches */
+	if (!(fuzzymatches = realloc(fuzzymatches, n * sizeof(struct item*))))
+		die("cannot realloc %zu bytes:", n * sizeof(struct item*));
+	stats_count(StatAlloc, n * sizeof(struct item*));
+	for (i = 0, it = *matches; it && i < n; i++, it = it->right) {
+		fuzzymatches[i] = it;
+	}
+	/* sort matches according to distance */
+	qsort(fuzzymatches, n, sizeof(struct item*), compare_distance);
+	/* rebuild list of matches */
+	*matches = *matchend = NULL;
+	for (i = 0; i < n; ++i) {
+		it = fuzzymatches[i];
+		if (!it || !it->text) continue;
+		match_append(it, matches, matchend);
+	}
+	free(fuzzymatches);
+	stats_time(StatSort, t);
+	trace_arg("sort", tr, n);
+}
+
+/* Aho-Corasick automaton of the -F tokens: a transition from every state
+ * for every byte, case folded ones included, and the tokens, one bit each,
+ * found on the way to a state */
+typedef struct {
+	int (*next)[256];
+	uint64_t *found;
+	int *fail, *queue;
+	int n, size;
+} Automaton;
+
+static int acstate(Automaton *ac) {
+	size_t n;
+
+	if (ac->n == ac->size) {
+		ac->size = ac->size ? ac->size * 2 : 64;
+		n = ac->size * (sizeof(*ac->next) + sizeof(*ac->found) + 2 * sizeof(int));
+		if (!(ac->next = realloc(ac->next, ac->size * sizeof(*ac->next))) ||
+		    !(ac->found = realloc(ac->found, ac->size * sizeof(*ac->found))) ||
+		    !(ac->fail = realloc(ac->fail, ac->size * sizeof(int))) ||
+		    !(ac->queue = realloc(ac->queue, ac->size * sizeof(int))))
+			die("cannot realloc %zu bytes:", n);
+		stats_count(StatAlloc, n);
+	}
+	memset(ac->next[ac->n], 0, sizeof(*ac->next));
+	ac->found[ac->n] = ac->fail[ac->n] = 0;
+	return ac->n++;
+}
+
+/* build the automaton of the tokc <= 64 tokens of tokv */
+static void accompile(Automaton *ac, int casesensitive, char **tokv, int tokc) {
+	unsigned char fold[256], *p;
+	int c, i, s, t, head, tail;
+
+	for (c = 0; c < 256; c++)
+		fold[c] = casesensitive ? c : tolower(c);
+	ac->n = 0;
+	acstate(ac);
+	/* the trie of the folded tokens, the root is no one's child */
+	for (i = 0; i < tokc; i++) {
+		for (s = 0, p = (unsigned char *)tokv[i]; *p; s = t, p++)
+			if (!(t = ac->next[s][fold[*p]])) {
+				/* acstate() moves the table */
+				t = acstate(ac);
+				ac->next[s][fold[*p]] = t;
+			}
+		ac->found[s] |= 1ULL << i;
+	}
+	/* breadth first, the state a failure falls back to is shallower and
+	 * has all of its transitions already */
+	for (c = head = tail = 0; c < 256; c++)
+		if ((t = ac->next[0][c]))
+			ac->queue[tail++] = t;
+	while (head < tail) {
+		s = ac->queue[head++];
+		ac->found[s] |= ac->found[ac->fail[s]];
+		for (c = 0; c < 256; c++) {
+			if ((t = ac->next[s][c])) {
+				ac->fail[t] = ac->next[ac->fail[s]][c];
+				ac->queue[tail++] = t;
+			} else {
+				ac->next[s][c] = ac->next[ac->fail[s]][c];
+			}
+		}
+	}
+	/* the other case goes where its folded byte goes */
+	for (s = 0; s < ac->n; s++)
+		for (c = 0; c < 256; c++)
+			if (fold[c] != c)
+				ac->next[s][c] = ac->next[s][fold[c]];
+}
+
+/* 1 if all tokens are in s, looked for in one pass */
+static int acmatch(const Automaton *ac, const char *s, uint64_t all) {
+	uint64_t found = 0;
+	int state = 0;
+
+	for (; *s; s++)
+		if ((found |= ac->found[state = ac->next[state][(unsigned char)*s]]) == all)
+			return 1;
+	return !all;
+}
+
+/* 1 if text has all tokc tokens of tokv, through ac when they fit */
+static int hastokens(const Automaton *ac, char **tokv, int tokc, char *(*fstrstr)(const char *, const char *), const char *text) {
+	int i;
+
+	if (tokc <= 64)
+		return acmatch(ac, text, tokc < 64 ? (1ULL << tokc) - 1 : ~0ULL);
+	for (i = 0; i < tokc; i++)
+		if (!fstrstr(text, tokv[i]))
+			return 0;
+	return 1;
+}
+
+static int compare_text(const void *a, const void *b) {
+	return strcmp((*(struct item **)a)->text, (*(struct item **)b)->text);
+}
+
+static int compare_textci(const void *a, const void *b) {
+	return strcasecmp((*(struct item **)a)->text, (*(struct item **)b)->text);
+}
+
+static int compare_address(const void *a, const void *b) {
+	struct item *ia = *(struct item **)a, *ib = *(struct item **)b;
+	return ia < ib ? -1 : ia > ib;
+}
+
+/* Sort the items of list by text, case folded unless conf->casesensitive,
+ * for match_tokens() to find the exact matches and the prefixes of the
+ * first token by binary search. */
+void match_index(MatchIndex *ix, const MatchConf *conf, struct item *list) {
+	size_t i, n;
+
+	match_index_free(ix);
+	for (n = 0; list && list[n].text; n++)
+		;
+	ix->sorted = ecalloc(n + 1, sizeof(*ix->sorted));
+	ix->rank = ecalloc(n + 1, sizeof(*ix->rank));
+	for (i = 0; i < n; i++)
+		ix->sorted[i] = &list[i];
+	qsort(ix->sorted, n, sizeof(*ix->sorted), conf->casesensitive ? compare_text : compare_textci);
+	for (i = 0; i < n; i++)
+		ix->rank[ix->sorted[i] - list] = i;
+	ix->list = list;
+	ix->n = n;
+	ix->casesensitive = conf->casesensitive;
+}
+
+void match_index_free(MatchIndex *ix) {
+	free(ix->sorted);
+	free(ix->rank);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/* the first position in the index whose text begins above prefix, or with
+ * it unless above is set */
+static size_t bound(const MatchIndex *ix, int (*fstrncmp)(const char *, const char *, size_t), const char *prefix, size_t len, int above) {
+	size_t lo = 0, hi = ix->n, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = fstrncmp(ix->sorted[mid]->text, prefix, len);
+		if (c < 0 || (above && !c))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* -F: items containing every space separated token of text, exact matches
+ * first, then prefixes of the first token, then substrings. ix, an index
+ * of list or NULL, gives the first two without comparing every item. */
+void match_tokens(const MatchConf *conf, const MatchIndex *ix, const char *text, struct item *list, struct item **matches, struct item **matchend) {
+	static char **tokv = NULL;
+	static int tokn = 0;
+	static struct item **range = NULL;
+	static size_t rangen = 0;
+	static Automaton ac;
+
+	int (*fstrncmp)(const char *, const char *, size_t) = conf->casesensitive ? strncmp : strncasecmp;
+	char *(*fstrstr)(const char *, const char *) = conf->casesensitive ? strstr : cistrstr;
+	char buf[BUFSIZ], *s;
+	int tokc = 0;
+	size_t i, k, r, len, textsize, lo = 0, hi = 0;
+	struct item *item, *lprefix, *lsubstr, *prefixend, *substrend;
+
+	snprintf(buf, sizeof buf, "%s", text);
+	/* separate input text into tokens to be matched individually */
+	for (s = strtok(buf, " "); s; tokv[tokc - 1] = s, s = strtok(NULL, " "))
+		if (++tokc > tokn) {
+			if (!(tokv = realloc(tokv, ++tokn * sizeof *tokv)))
+				die("cannot realloc %zu bytes:", tokn * sizeof *tokv);
+			stats_count(StatAlloc, tokn * sizeof *tokv);
+		}
+	len = tokc ? strlen(tokv[0]) : 0;
+	/* one bit for each token, more are looked for one at a time */
+	if (tokc <= 64)
+		accompile(&ac, conf->casesensitive, tokv, tokc);
+
+	*matches = lprefix = lsubstr = *matchend = prefixend = substrend = NULL;
+	textsize = strlen(text) + 1;
+	/* the items beginning with the first token are a range of the index,
+	 * the exact matches among them unless text begins with a space */
+	if (ix && ix->list == list && ix->casesensitive == conf->casesensitive && tokc && tokv[0] == buf) {
+		lo = bound(ix, fstrncmp, tokv[0], len, 0);
+		hi = bound(ix, fstrncmp, tokv[0], len, 1);
+		if (hi - lo > rangen) {
+			rangen = hi - lo;
+			if (!(range = realloc(range, rangen * sizeof(*range))))
+				die("cannot realloc %zu bytes:", rangen * sizeof(*range));
+			stats_count(StatAlloc, rangen * sizeof(*range));
+		}
+		for (k = 0, r = lo; r < hi; r++)
+			if (hastokens(&ac, tokv, tokc, fstrstr, ix->sorted[r]->text))
+				range[k++] = ix->sorted[r];
+		/* in the order of the list, as without the index */
+		qsort(range, k, sizeof(*range), compare_address);
+		for (i = 0; i < k; i++)
+			if (!fstrncmp(text, range[i]->text, textsize))
+				match_append(range[i], matches, matchend);
+			else
+				match_append(range[i], &lprefix, &prefixend);
+	}
+	for (item = list; item && item->text; item++) {
+		/* taken from the index above, do not scan it twice */
+		if (lo < hi && ix->rank[item - list] >= lo && ix->rank[item - list] < hi)
+			continue;
+		if (!hastokens(&ac, tokv, tokc, fstrstr, item->text))
+			continue;
+		/* exact matches go first, then prefixes, then substrings */
+		if (!tokc || !fstrncmp(text, item->text, textsize))
+			match_append(item, matches, matchend);
+		else if (!fstrncmp(tokv[0], item->text, len))
+			match_append(item, &lprefix, &prefixend);
+		else
+			match_append(item, &lsubstr, &substrend);
+	}
+	stats_count(StatScanned, item - list);
+	if (lprefix) {
+		if (*matches) {
+			(*matchend)->right = lprefix;
+			lprefix->left = *matchend;
+		} else
+			*matches = lprefix;
+		*matchend = prefixend;
+	}
+	if (lsubstr) {
+		if (*matches) {
+			(*matchend)->right = lsubstr;
+			lsubstr->left = *matchend;
+		} else
+			*matches = lsubstr;
+		*matchend = substrend;
+	}
+}
@@ -0,0 +1,44 @@
+/* See LICENSE file for copyright and license details. */
+
+struct item {
+	char *text;
+	unsigned int len;
+	float bonus; /* for being selected lately, see frecency.h */
+	struct item *left, *right;
+	double distance;
+	uint64_t sig; /* see match_signature() */
+	unsigned char hp : 1;
+	unsigned char file : 1;
+	unsigned char folder : 1;
+	int w; /* TEXTW() of text, 0 until measured */
+};
+
+/* fuzzy scores, see config.def.h; a lower distance ranks first */
+typedef struct {
+	float exact, close, letter, letterci, nearstart, continuous;
+	float hp, file, folder, path;
+	int casesensitive;
+} MatchConf;
+
+/* Item abstraction */
+uint64_t match_signature(const char *s);
+void match_append(struct item *item, struct item **list, struct item **last);
+
+/* Fuzzy abstraction */
+size_t match_fuzzy(const MatchConf *conf, const char *search, int path, struct item *list, struct item **matches, struct item **matchend);
+void match_positions(const MatchConf *conf, int fuzzy, const char *search, const char *text, unsigned char *mask);
+void match_rank(struct item **matches, struct item **matchend, size_t n);
+
+/* -F index of a list, see match_index() */
+typedef struct {
+	struct item *list;
+	struct item **sorted;
+	size_t *rank; /* position in sorted of each item of list */
+	size_t n;
+	int casesensitive;
+} MatchIndex;
+
+/* Token abstraction, -F */
+void match_index(MatchIndex *ix, const MatchConf *conf, struct item *list);
+void match_index_free(MatchIndex *ix);
+void match_tokens(const MatchConf *conf, const MatchIndex *ix, const char *text, struct item *list, struct item **matches, struct item **matchend);
@@ -0,0 +1,411 @@
+/* See LICENSE file for copyright and license details. */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "match.h"
+#include "path.h"
+#include "util.h"
+
+#define MAXKEYS 256
+
+/* a generated list of lines and the items pointing into it */
+typedef struct {
+	const char *name;
+	char *blob;
+	size_t bloblen, blobsiz;
+	size_t *off;
+	struct item *items;
+	size_t n;
+} Corpus;
+
+/* the scores of config.def.h, case-insensitive */
+static const MatchConf conf = {
+	-4096.0, -2048.0, -32.0, -16.0, -32.0, -2.0, -16.0, 8.0, 8.0, -1024.0, 0
+};
+
+static const char *syllables[] = {
+	"ka", "lo", "mi", "nu", "re", "sa", "to", "vi", "xe", "zu", "bar", "con",
+	"dev", "fig", "gen", "hub", "lib", "mon", "net", "pro", "srv", "tar", "util",
+	"wm", "x", "py", "qt", "gtk", "sh", "fs", "io", "db",
+};
+static const char *exts[] = { ".c", ".h", ".txt", ".pdf", ".png", ".conf", ".md", ".tar.gz" };
+static const char *tlds[] = { "com", "org", "net", "io", "de" };
+static const char *levels[] = { "INFO", "WARN", "ERROR", "DEBUG" };
+
+static char **pathnames;
+static size_t npathnames;
+static unsigned long allocs; /* malloc, calloc and realloc calls */
+static uint64_t rng = 88172645463325252ULL;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *
+__wrap_malloc(size_t n)
+{
+	allocs++;
+	return __real_malloc(n);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t n)
+{
+	allocs++;
+	return __real_realloc(p, n);
+}
+
+static uint64_t
+rnd(uint64_t n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng % n;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static char *
+word(char *p)
+{
+	int i, n = 1 + rnd(3);
+
+	for (i = 0; i < n; i++)
+		p += sprintf(p, "%s", syllables[rnd(LENGTH(syllables))]);
+	return p;
+}
+
+/* the executables in $PATH, then variants of them */
+static void
+genpath(char *p, size_t i)
+{
+	if (!npathnames) {
+		word(p);
+	} else if (i < npathnames) {
+		strcpy(p, pathnames[i]);
+	} else {
+		p += sprintf(p, "%s", pathnames[rnd(npathnames)]);
+		if (rnd(2))
+			sprintf(p, "-%d.%d", (int)rnd(10), (int)rnd(100));
+		else
+			word(p + sprintf(p, "-"));
+	}
+}
+
+static void
+genfile(char *p, size_t i)
+{
+	int j, n = 1 + rnd(5);
+
+	p += sprintf(p, "/home/user");
+	for (j = 0; j < n; j++)
+		p = word(p + sprintf(p, "/"));
+	sprintf(word(p + sprintf(p, "/")), "%s", exts[rnd(LENGTH(exts))]);
+}
+
+static void
+genurl(char *p, size_t i)
+{
+	int j, n = rnd(4);
+
+	p += sprintf(p, "https://%s", rnd(2) ? "www." : "");
+	p = word(word(p));
+	p += sprintf(p, ".%s", tlds[rnd(LENGTH(tlds))]);
+	for (j = 0; j < n; j++)
+		p = word(p + sprintf(p, "/"));
+	if (rnd(2))
+		sprintf(p, "?id=%lu", (unsigned long)rnd(1000000));
+}
+
+static void
+genlog(char *p, size_t i)
+{
+	int j, n = 8 + rnd(8);
+
+	p += sprintf(p, "2026-10-%02dT%02d:%02d:%02d.%03dZ %s [", 1 + (int)rnd(28),
+	             (int)rnd(24), (int)rnd(60), (int)rnd(60), (int)rnd(1000),
+	             levels[rnd(LENGTH(levels))]);
+	p = word(p);
+	p += sprintf(p, "]");
+	for (j = 0; j < n; j++)
+		p = word(p + sprintf(p, " "));
+}
+
+static void
+gencorpus(Corpus *c, const char *name, void (*gen)(char *, size_t), size_t n)
+{
+	char line[1024];
+	size_t i, len;
+
+	c->name = name;
+	c->n = n;
+	c->bloblen = 0;
+	c->blobsiz = n * 32;
+	c->blob = ecalloc(c->blobsiz, 1);
+	c->off = ecalloc(n, sizeof(*c->off));
+	c->items = ecalloc(n + 1, sizeof(*c->items));
+	for (i = 0; i < n; i++) {
+		gen(line, i);
+		len = strlen(line) + 1;
+		if (c->bloblen + len > c->blobsiz) {
+			c->blobsiz = c->blobsiz * 2 + len;
+			if (!(c->blob = realloc(c->blob, c->blobsiz)))
+				die("cannot realloc %zu bytes:", c->blobsiz);
+		}
+		memcpy(c->blob + c->bloblen, line, len);
+		c->off[i] = c->bloblen;
+		c->bloblen += len;
+	}
+	/* the blob has stopped moving */
+	for (i = 0; i < n; i++) {
+		c->items[i].text = c->blob + c->off[i];
+		c->items[i].len = strlen(c->items[i].text);
+		c->items[i].sig = match_signature(c->items[i].text);
+	}
+}
+
+static void
+freecorpus(Corpus *c)
+{
+	free(c->blob);
+	free(c->off);
+	free(c->items);
+}
+
+/* what a user types to find the line: some of it, a typo taken back with
+ * backspace and the rest; every keystroke is one query */
+static int
+keystrokes(const char *line, char queries[][64], int max)
+{
+	char target[32];
+	size_t i, len, k = 0, start = 0;
+	const char *p;
+
+	/* start at the last path component or a word in the middle */
+	if ((p = strrchr(line, '/')) && p[1])
+		start = p + 1 - line;
+	else if ((p = strchr(line + strlen(line) / 2, ' ')) && p[1])
+		start = p + 1 - line;
+	for (len = 0; len < sizeof(target) - 1 && line[start + len] && len < 8; len++)
+		target[len] = line[start + len];
+	target[len] = '\0';
+
+	for (i = 1; i <= len && k < max; i++, k++)
+		snprintf(queries[k], 64, "%.*s", (int)i, target);
+	for (i = len; i > len / 2 && k < max; i--, k++)
+		snprintf(queries[k], 64, "%.*s", (int)i - 1, target);
+	for (i = len / 2 + 1; i <= len && k < max; i++, k++)
+		snprintf(queries[k], 64, "%.*s", (int)i, target);
+	return k;
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* a fuzzy query like dmenu's: the last word, after the last slash */
+static size_t
+fuzzy(const MatchConf *conf, const char *text, struct item *items)
+{
+	struct item *matches = NULL, *matchend = NULL;
+	const char *base = text, *c;
+	int path = 0;
+	size_t n;
+
+	for (c = text; *c; c++)
+		if (*c == ' ')
+			base = c + 1;
+	for (c = base; *c; c++)
+		if (*c == '/') {
+			base = c + 1;
+			path = 1;
+		}
+	n = match_fuzzy(conf, base, path, items, &matches, &matchend);
+	match_rank(&matches, &matchend, n);
+	return n;
+}
+
+static size_t
+tokens(const MatchConf *conf, const MatchIndex *ix, const char *text, struct item *items)
+{
+	struct item *matches = NULL, *matchend = NULL, *it;
+	size_t n = 0;
+
+	match_tokens(conf, ix, text, items, &matches, &matchend);
+	for (it = matches; it; it = it->right)
+		n++;
+	return n;
+}
+
+/* fuzzy matching, or -F without and with ix */
+static void
+bench(Corpus *c, int fuzzymode, const MatchIndex *ix)
+{
+	static char queries[MAXKEYS][64];
+	double lat[MAXKEYS], t, total = 0;
+	unsigned long a = 0;
+	size_t found = 0;
+	int i, j, k = 0;
+
+	/* three lines spread over the corpus */
+	for (i = 1; i <= 3; i++)
+		k += keystrokes(c->items[c->n * i / 4].text, queries + k, MAXKEYS - k);
+	for (j = 0; j < k; j++) {
+		allocs = 0;
+		t = now();
+		found += fuzzymode ? fuzzy(&conf, queries[j], c->items) :
+		                     tokens(&conf, ix, queries[j], c->items);
+		lat[j] = now() - t;
+		a += allocs;
+		total += lat[j];
+	}
+	qsort(lat, k, sizeof(*lat), cmpdouble);
+	printf("%-5s %9zu %-6s %4d %9.3f %9.3f %9.3f %9.3f %9.2f %9.1f %10zu\n",
+	       c->name, c->n, fuzzymode ? "fuzzy" : ix ? "-F ix" : "-F", k,
+	       lat[k / 2], lat[k * 90 / 100], lat[k * 99 / 100], lat[k - 1],
+	       total > 0 ? (double)c->n * k / total / 1000.0 : 0.0,
+	       (double)a / k, found / k);
+	fflush(stdout);
+}
+
+/* every token of query in s, found the slow way, ignoring case */
+static int
+hastokens(const char *s, const char *query)
+{
+	char buf[4096], *tok;
+	size_t i;
+	const char *h;
+
+	snprintf(buf, sizeof buf, "%s", query);
+	for (tok = strtok(buf, " "); tok; tok = strtok(NULL, " ")) {
+		for (h = s; *h; h++) {
+			for (i = 0; tok[i] && tolower((unsigned char)tok[i]) == tolower((unsigned char)h[i]); i++)
+				;
+			if (!tok[i])
+				break;
+		}
+		if (!*h)
+			return 0;
+	}
+	return 1;
+}
+
+/* -F with queries of many tokens against hastokens(): more than the 64
+ * bytes the automaton starts with, and more tokens than it has bits for */
+static void
+check(Corpus *c, const MatchIndex *ix)
+{
+	struct item *matches = NULL, *matchend = NULL, *it;
+	const char *line = c->items[c->n / 2].text;
+	char query[4096], *p;
+	size_t i, j, len = strlen(line), want, got;
+	int q, k;
+
+	for (q = 0; q < 2; q++) {
+		/* overlapping pieces of a line, in mixed case */
+		for (p = query, k = 0; k < (q ? 80 : 24); k++) {
+			for (j = 0, i = len ? k * 3 % len : 0; j < 3 && i + j < len; j++)
+				*p++ = k % 2 ? toupper((unsigned char)line[i + j]) : line[i + j];
+			*p++ = ' ';
+		}
+		*p = '\0';
+		for (want = 0, it = c->items; it->text; it++)
+			want += hastokens(it->text, query);
+		match_tokens(&conf, ix, query, c->items, &matches, &matchend);
+		for (got = 0, it = matches; it; it = it->right)
+			got++;
+		if (got != want)
+			die("%s: %zu matches for a query of %d tokens, not %zu", c->name, got, k, want);
+	}
+}
+
+static void
+usage(void)
+{
+	die("usage: match_bench [lines ...]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		void (*gen)(char *, size_t);
+	} kinds[] = {
+		{ "path", genpath }, { "file", genfile },
+		{ "url",  genurl },  { "log",  genlog },
+	};
+	static const char *dflt[] = { "1000", "100000", "1000000", "10000000" };
+	PathDir *dirs;
+	MatchIndex ix = { 0 };
+	Corpus c;
+	char *path, *name, **sizes = argv + 1;
+	size_t i, j, k, n, ndirs;
+	int nsizes = argc - 1;
+
+	if (!nsizes) {
+		sizes = (char **)dflt;
+		nsizes = LENGTH(dflt);
+	}
+	for (i = 0; i < nsizes; i++)
+		if (strtoul(sizes[i], NULL, 10) == 0)
+			usage();
+
+	/* real command names make the path corpus realistic */
+	if (!(path = getenv("PATH")))
+		path = "";
+	dirs = path_dirs(path, &ndirs);
+	path_scan(dirs, ndirs);
+	for (i = 0; i < ndirs; i++)
+		npathnames += dirs[i].n;
+	pathnames = ecalloc(npathnames + 1, sizeof(*pathnames));
+	for (i = k = 0; i < ndirs; i++)
+		for (j = 0, name = dirs[i].names; j < dirs[i].n; j++, name += strlen(name) + 1)
+			pathnames[k++] = name;
+
+	printf("%-5s %9s %-6s %4s %9s %9s %9s %9s %9s %9s %10s\n", "kind", "lines",
+	       "mode", "keys", "p50 ms", "p90 ms", "p99 ms", "max ms", "Mlines/s",
+	       "allocs/q", "matches/q");
+	for (i = 0; i < nsizes; i++) {
+		n = strtoul(sizes[i], NULL, 10);
+		for (j = 0; j < LENGTH(kinds); j++) {
+			rng = 88172645463325252ULL;
+			gencorpus(&c, kinds[j].name, kinds[j].gen, n);
+			bench(&c, 1, NULL);
+			bench(&c, 0, NULL);
+			match_index(&ix, &conf, c.items);
+			bench(&c, 0, &ix);
+			check(&c, NULL);
+			check(&c, &ix);
+			match_index_free(&ix);
+			freecorpus(&c);
+		}
+	}
+
+	free(pathnames);
+	path_free(dirs, ndirs);
+	return 0;
+}
@@ -0,0 +1,284 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define __USE_MISC
+#include <dirent.h>
+#undef __USE_MISC
+
+#include "path.h"
+#include "util.h"
+
+/* manifest: MAGIC, then per directory a record of RECFIELDS integers
+ * (path length, dev, ino, mtime sec and nsec, name count, names length)
+ * followed by the path and the NUL separated names; native byte order as
+ * the manifest never leaves the machine. A directory that did not exist
+ * has a record with ino 0 and no names. */
+#define MAGIC     "dmenupt1"
+#define RECFIELDS 7
+
+static void setstat(PathDir *d, const struct stat *st) {
+	d->dev = st->st_dev;
+	d->ino = st->st_ino;
+	d->sec = st->st_mtim.tv_sec;
+	d->nsec = st->st_mtim.tv_nsec;
+}
+
+PathDir *path_dirs(const char *path, size_t *n) {
+	PathDir *dirs;
+	const char *p, *end;
+	size_t i, len, cap = 1;
+
+	for (p = path; *p; p++)
+		cap += *p == ':';
+	dirs = ecalloc(cap, sizeof(*dirs));
+	for (*n = 0, p = path; *p; p = *end ? end + 1 : end) {
+		if (!(end = strchr(p, ':')))
+			end = p + strlen(p);
+		if (!(len = end - p))
+			continue;
+		/* a directory listed twice is only scanned once */
+		for (i = 0; i < *n && (strlen(dirs[i].path) != len ||
+		     strncmp(dirs[i].path, p, len)); i++)
+			;
+		if (i < *n)
+			continue;
+		dirs[*n].path = ecalloc(len + 1, 1);
+		memcpy(dirs[*n].path, p, len);
+		dirs[*n].local = strstr(dirs[*n].path, "local") != NULL;
+		(*n)++;
+	}
+	return dirs;
+}
+
+void path_free(PathDir *dirs, size_t n) {
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		free(dirs[i].path);
+		free(dirs[i].names);
+	}
+	free(dirs);
+}
+
+/* same as stest -flx: visible, regular after following links, executable */
+static void *scandir_(void *arg) {
+	PathDir *d = arg;
+	struct dirent *e;
+	struct stat st;
+	DIR *dir;
+	size_t cap = 0, len;
+	int fd;
+
+	if (!(dir = opendir(d->path))) {
+		/* kept as it is, empty, until it changes */
+		if (!stat(d->path, &st))
+			setstat(d, &st);
+		return NULL;
+	}
+	fd = dirfd(dir);
+	/* taken before reading, a change during the scan is seen next time */
+	if (!fstat(fd, &st))
+		setstat(d, &st);
+	while ((e = readdir(dir))) {
+		if (e->d_name[0] == '.')
+			continue;
+		/* d_type saves the stat for regular files, links need one */
+		if (e->d_type != DT_REG && ((e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) ||
+		    fstatat(fd, e->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)))
+			continue;
+		if (faccessat(fd, e->d_name, X_OK, 0) < 0)
+			continue;
+		len = strlen(e->d_name) + 1;
+		if (d->len + len > cap) {
+			cap = MAX(cap * 2, d->len + len + 4096);
+			if (!(d->names = realloc(d->names, cap)))
+				die("cannot realloc %zu bytes:", cap);
+		}
+		memcpy(d->names + d->len, e->d_name, len);
+		d->len += len;
+		d->n++;
+	}
+	closedir(dir);
+	return NULL;
+}
+
+/* scan all directories at once, each on its own thread */
+void path_scan(PathDir *dirs, size_t n) {
+	pthread_t *threads = ecalloc(n, sizeof(*threads));
+	char *started = ecalloc(n, 1);
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (dirs[i].cached)
+			continue;
+		free(dirs[i].names);
+		dirs[i].names = NULL;
+		dirs[i].len = dirs[i].n = 0;
+		/* without a thread the directory is scanned right here */
+		if (!(started[i] = !pthread_create(&threads[i], NULL, scandir_, &dirs[i])))
+			scandir_(&dirs[i]);
+	}
+	for (i = 0; i < n; i++)
+		if (!dirs[i].cached && started[i])
+			pthread_join(threads[i], NULL);
+	free(threads);
+	free(started);
+}
+
+/* Reuse the names of each directory whose dev, inode and mtime still match
+ * the manifest, or that is still missing, those are marked cached. Returns
+ * the number of directories path_scan() still has to read. */
+size_t path_load(PathDir *dirs, size_t n, const char *file) {
+	struct stat st;
+	uint64_t rec[RECFIELDS];
+	char *buf = NULL, *p, *end;
+	size_t i, left = n, siz = 0, len = 0;
+	ssize_t r;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return left;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		siz = st.st_size;
+		buf = ecalloc(siz, 1);
+		while (len < siz && ((r = read(fd, buf + len, siz - len)) > 0 ||
+		       (r < 0 && errno == EINTR)))
+			len += r > 0 ? r : 0;
+	}
+	close(fd);
+	if (len != siz || len < sizeof(MAGIC) - 1 || memcmp(buf, MAGIC, sizeof(MAGIC) - 1)) {
+		free(buf);
+		return left;
+	}
+
+	for (p = buf + sizeof(MAGIC) - 1, end = buf + len; left && (size_t)(end - p) >= sizeof(rec); ) {
+		memcpy(rec, p, sizeof(rec));
+		p += sizeof(rec);
+		if (rec[0] > (uint64_t)(end - p) || rec[6] > (uint64_t)(end - p) - rec[0])
+			break; /* truncated */
+		for (i = 0; i < n; i++)
+			if (!dirs[i].cached && strlen(dirs[i].path) == rec[0] &&
+			    !memcmp(dirs[i].path, p, rec[0]))
+				break;
+		if (i < n && !rec[2] && stat(dirs[i].path, &st) < 0) {
+			dirs[i].cached = 1;
+			left--;
+		} else if (i < n && rec[2] && !stat(dirs[i].path, &st) && (uint64_t)st.st_dev == rec[1] &&
+		    (uint64_t)st.st_ino == rec[2] && (int64_t)st.st_mtim.tv_sec == (int64_t)rec[3] &&
+		    (int64_t)st.st_mtim.tv_nsec == (int64_t)rec[4]) {
+			setstat(&dirs[i], &st);
+			free(dirs[i].names);
+			dirs[i].names = rec[6] ? ecalloc(rec[6], 1) : NULL;
+			memcpy(dirs[i].names, p + rec[0], rec[6]);
+			dirs[i].len = rec[6];
+			dirs[i].n = rec[5];
+			dirs[i].cached = 1;
+			left--;
+		}
+		p += rec[0] + rec[6];
+	}
+	free(buf);
+	return left;
+}
+
+/* Write the manifest of all directories, replacing file at once. Returns -1
+ * on error. */
+int path_save(PathDir *dirs, size_t n, const char *file) {
+	char tmp[PATH_MAX];
+	uint64_t rec[RECFIELDS];
+	size_t i;
+	FILE *fp;
+	int err;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid()) >= sizeof(tmp) ||
+	    !(fp = fopen(tmp, "w")))
+		return -1;
+	err = fwrite(MAGIC, 1, sizeof(MAGIC) - 1, fp) != sizeof(MAGIC) - 1;
+	for (i = 0; i < n && !err; i++) {
+		rec[0] = strlen(dirs[i].path);
+		rec[1] = dirs[i].dev;
+		rec[2] = dirs[i].ino;
+		rec[3] = dirs[i].sec;
+		rec[4] = dirs[i].nsec;
+		rec[5] = dirs[i].n;
+		rec[6] = dirs[i].len;
+		err = fwrite(rec, sizeof(rec), 1, fp) != 1 ||
+		      fwrite(dirs[i].path, 1, rec[0], fp) != rec[0] ||
+		      fwrite(dirs[i].names, 1, rec[6], fp) != rec[6];
+	}
+	if (fclose(fp) || err || rename(tmp, file)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static int cmpname(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static uint32_t hash(const char *s) {
+	uint32_t h = 2166136261u;
+
+	for (; *s; s++)
+		h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+/* Build the newline separated list of unique names, those found in a local
+ * directory first and marked with hpchar, each group sorted. The caller has
+ * to free(3) the list. */
+size_t path_list(PathDir *dirs, size_t n, char hpchar, char **list) {
+	char **set, **names, *name, *p;
+	size_t i, j, total = 0, size = 1, len = 0, nnames = 0, nlocal = 0, start, h;
+	int pass;
+
+	for (i = 0; i < n; i++)
+		total += dirs[i].n;
+	while (size < total * 2)
+		size <<= 1;
+	set = ecalloc(size, sizeof(*set));
+	names = ecalloc(total + 1, sizeof(*names));
+
+	/* local directories take priority, so they go in first */
+	for (pass = 1; pass >= 0; pass--) {
+		start = nnames;
+		for (i = 0; i < n; i++) {
+			if (dirs[i].local != pass)
+				continue;
+			for (j = 0, name = dirs[i].names; j < dirs[i].n; j++, name += strlen(name) + 1) {
+				for (h = hash(name) & (size - 1); set[h] && strcmp(set[h], name); h = (h + 1) & (size - 1))
+					;
+				if (set[h])
+					continue;
+				set[h] = names[nnames++] = name;
+				len += strlen(name) + 2;
+			}
+		}
+		qsort(names + start, nnames - start, sizeof(*names), cmpname);
+		if (pass)
+			nlocal = nnames;
+	}
+
+	p = *list = ecalloc(len + 1, 1);
+	for (i = 0; i < nnames; i++) {
+		if (i < nlocal && hpchar)
+			*p++ = hpchar;
+		len = strlen(names[i]);
+		memcpy(p, names[i], len);
+		p += len;
+		*p++ = '\n';
+	}
+	free(set);
+	free(names);
+	return p - *list;
+}
@@ -0,0 +1,25 @@
+/* See LICENSE file for copyright and license details. */
+
+/* a directory of $PATH and the executables found in it */
+typedef struct {
+	char *path;
+	int local;    /* executables get the high priority marker */
+	char *names;  /* NUL separated */
+	size_t len, n;
+	/* the directory as it was when names was read */
+	uint64_t dev, ino;
+	int64_t sec, nsec;
+	int cached;   /* names came from the manifest, path_scan() skips it */
+} PathDir;
+
+/* Directory abstraction */
+PathDir *path_dirs(const char *path, size_t *n);
+void path_scan(PathDir *dirs, size_t n);
+void path_free(PathDir *dirs, size_t n);
+
+/* Manifest abstraction */
+size_t path_load(PathDir *dirs, size_t n, const char *file);
+int path_save(PathDir *dirs, size_t n, const char *file);
+
+/* List abstraction */
+size_t path_list(PathDir *dirs, size_t n, char hpchar, char **list);
@@ -0,0 +1,142 @@
+/* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "match.h"
+#include "snap.h"
+#include "util.h"
+
+#define MAGIC "dmenusn1"
+
+/* the file is the magic, a Header, n Records and the NUL separated texts */
+typedef struct {
+	uint64_t key, fontkey, n, bloblen;
+	int64_t maxw;
+} Header;
+
+typedef struct {
+	uint64_t sig;
+	uint32_t off, len;
+	int32_t w;
+	uint32_t hp;
+} Record;
+
+uint64_t snap_hash(const void *data, size_t len, uint64_t seed) {
+	const unsigned char *p = data;
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL), w;
+
+	for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for (; len; p++, len--)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	return h ^ (h >> 29);
+}
+
+/* Map the snapshot in file if it was taken of the input with key and
+ * return its n items, NULL if there is none. The texts point into the
+ * mapping, which snap_free() releases; the caller has to free(3) the
+ * items. */
+struct item *snap_load(Snap *s, const char *file, uint64_t key, size_t *n) {
+	struct stat st;
+	struct item *items;
+	const Record *rec;
+	Header hdr;
+	char *map, *blob;
+	size_t i, off = sizeof(MAGIC) - 1 + sizeof(hdr);
+	int fd;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+	/* private and writable like any other item text, never written back */
+	if (fstat(fd, &st) < 0 || st.st_size < off ||
+	    (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	memcpy(&hdr, map + sizeof(MAGIC) - 1, sizeof(hdr));
+	if (memcmp(map, MAGIC, sizeof(MAGIC) - 1) || hdr.key != key || !hdr.bloblen ||
+	    hdr.n > (st.st_size - off) / sizeof(*rec) ||
+	    hdr.bloblen != st.st_size - off - hdr.n * sizeof(*rec) ||
+	    map[st.st_size - 1] != '\0') {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	rec = (const Record *)(map + off);
+	blob = map + off + hdr.n * sizeof(*rec);
+	items = ecalloc(hdr.n + 1, sizeof(*items));
+	for (i = 0; i < hdr.n; i++) {
+		/* the text must end exactly at len: the highlighting sizes its
+		 * mask from len and marks up to strlen() */
+		if ((uint64_t)rec[i].off + rec[i].len >= hdr.bloblen ||
+		    memchr(blob + rec[i].off, '\0', rec[i].len + 1) != blob + rec[i].off + rec[i].len) {
+			free(items);
+			munmap(map, st.st_size);
+			return NULL;
+		}
+		items[i].text = blob + rec[i].off;
+		items[i].len = rec[i].len;
+		items[i].sig = rec[i].sig;
+		items[i].w = rec[i].w;
+		items[i].hp = rec[i].hp;
+	}
+	s->map = map;
+	s->maplen = st.st_size;
+	s->fontkey = hdr.fontkey;
+	s->maxw = hdr.maxw;
+	*n = hdr.n;
+	return items;
+}
+
+void snap_free(Snap *s) {
+	if (s->map)
+		munmap(s->map, s->maplen);
+	s->map = NULL;
+	s->maplen = 0;
+}
+
+/* Write the snapshot of the input with key, replacing file at once. The
+ * widths were measured with the font set fontkey, maxw is -1 if they were
+ * not. Returns -1 on error. */
+int snap_save(const char *file, uint64_t key, uint64_t fontkey, const struct item *items, size_t n, int maxw) {
+	Header hdr = { key, fontkey, n, 0, maxw };
+	Record rec;
+	char tmp[PATH_MAX];
+	size_t i;
+	FILE *fp;
+	int err;
+
+	for (i = 0; i < n; i++)
+		hdr.bloblen += items[i].len + 1;
+	if (hdr.bloblen > UINT32_MAX ||
+	    (size_t)snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid()) >= sizeof(tmp) ||
+	    !(fp = fopen(tmp, "w")))
+		return -1;
+	err = fwrite(MAGIC, 1, sizeof(MAGIC) - 1, fp) != sizeof(MAGIC) - 1 ||
+	      fwrite(&hdr, sizeof(hdr), 1, fp) != 1;
+	for (i = 0, rec.off = 0; i < n && !err; rec.off += items[i++].len + 1) {
+		rec.sig = items[i].sig;
+		rec.len = items[i].len;
+		rec.w = items[i].w;
+		rec.hp = items[i].hp;
+		err = fwrite(&rec, sizeof(rec), 1, fp) != 1;
+	}
+	for (i = 0; i < n && !err; i++)
+		err = fwrite(items[i].text, 1, items[i].len + 1, fp) != items[i].len + 1;
+	if (fclose(fp) || err || rename(tmp, file)) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details. */
+
+/* A snapshot of the items read from an input and of their widths, so the
+ * next start with the same input maps it instead of parsing and measuring.
+ * The widths only hold for the font set the snapshot names. */
+typedef struct {
+	void *map;
+	size_t maplen;
+	uint64_t fontkey;
+	int maxw; /* -1 if not measured */
+} Snap;
+
+uint64_t snap_hash(const void *data, size_t len, uint64_t seed);
+struct item *snap_load(Snap *s, const char *file, uint64_t key, size_t *n);
+void snap_free(Snap *s);
+int snap_save(const char *file, uint64_t key, uint64_t fontkey, const struct item *items, size_t n, int maxw);
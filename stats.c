@@ -0,0 +1,162 @@
+/* See LICENSE file for copyright and license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "timing.h"
+
+#define BUCKETS 256 /* four per power of two of a 64 bit value */
+
+/* log scale histogram of microseconds or of counts */
+typedef struct {
+	unsigned long n, bucket[BUCKETS];
+	unsigned long long max;
+} Hist;
+
+static const char *names[StatLast] = {
+	[StatKey] = "keypress", [StatMatch] = "match", [StatReadfolder] = "readfolder",
+	[StatSort] = "sort", [StatDrawmenu] = "drawmenu", [StatDrwMap] = "drw_map",
+	[StatDrwText] = "drw_text", [StatScanned] = "scanned", [StatRejected] = "rejected",
+	[StatRequests] = "requests", [StatAlloc] = "alloc_bytes",
+};
+
+static FILE *fp;
+static Hist hists[StatLast];
+static unsigned long long cur[StatLast]; /* counters of the current keystroke */
+static int sigpipe[2] = { -1, -1 };
+
+static int bucket(unsigned long long v) {
+	int b;
+
+	if (v < 4)
+		return v;
+	for (b = 63; !(v >> b); b--)
+		;
+	return (b - 1) * 4 + ((v >> (b - 2)) & 3);
+}
+
+/* largest value that falls into bucket i */
+static unsigned long long upper(int i) {
+	if (i < 4)
+		return i;
+	return ((4ULL + i % 4 + 1) << (i / 4 - 1)) - 1;
+}
+
+static void add(Hist *h, unsigned long long v) {
+	h->n++;
+	h->bucket[bucket(v)]++;
+	if (v > h->max)
+		h->max = v;
+}
+
+static unsigned long long percentile(const Hist *h, int p) {
+	unsigned long seen = 0, want = (h->n * p + 99) / 100;
+	int i;
+
+	for (i = 0; i < BUCKETS; i++)
+		if ((seen += h->bucket[i]) >= want)
+			return upper(i) < h->max ? upper(i) : h->max;
+	return h->max;
+}
+
+static void onusr1(int sig) {
+	int e = errno;
+
+	/* the main loop polls the other end */
+	if (write(sigpipe[1], "", 1) < 0) {}
+	errno = e;
+}
+
+void stats_init(void) {
+	const char *dest = getenv("DMENU_STATS");
+	struct sigaction sa;
+
+	if (!dest)
+		return;
+	if (!*dest || !strcmp(dest, "-"))
+		fp = stderr;
+	else if (!(fp = fopen(dest, "a"))) {
+		perror(dest);
+		return;
+	}
+	if (pipe(sigpipe) < 0)
+		return;
+	fcntl(sigpipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(sigpipe[1], F_SETFL, O_NONBLOCK);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onusr1;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* read end of the pipe SIGUSR1 writes to, -1 if statistics are off */
+int stats_fd(void) {
+	return fp ? sigpipe[0] : -1;
+}
+
+/* 0 when statistics are off, saving the clock */
+double stats_start(void) {
+	return fp ? timing_now() : 0;
+}
+
+void stats_time(int stat, double start) {
+	if (fp)
+		add(&hists[stat], (timing_now() - start) * 1000);
+}
+
+void stats_count(int stat, unsigned long n) {
+	if (fp)
+		cur[stat] += n;
+}
+
+/* a keystroke is handled, its counters become samples */
+void stats_key(void) {
+	int i;
+
+	if (!fp)
+		return;
+	for (i = StatDrwText; i < StatLast; i++) {
+		add(&hists[i], cur[i]);
+		cur[i] = 0;
+	}
+}
+
+/* drop what was counted before the first keystroke, like reading the items */
+void stats_reset(void) {
+	memset(cur, 0, sizeof(cur));
+}
+
+void stats_dump(void) {
+	const Hist *h;
+	int i;
+	double div;
+
+	if (!fp)
+		return;
+	for (i = 0; i < StatLast; i++) {
+		if (!(h = &hists[i])->n)
+			continue;
+		div = i < StatDrwText ? 1000.0 : 1.0;
+		fprintf(fp, "{\"pid\":%ld,\"stat\":\"%s\",\"unit\":\"%s\",\"n\":%lu,"
+		        "\"p50\":%g,\"p90\":%g,\"p99\":%g,\"max\":%g}\n",
+		        (long)getpid(), names[i], i < StatDrwText ? "ms" : "key", h->n,
+		        percentile(h, 50) / div, percentile(h, 90) / div,
+		        percentile(h, 99) / div, h->max / div);
+	}
+	fflush(fp);
+}
+
+/* called when stats_fd() is readable */
+void stats_signal(void) {
+	char buf[64];
+
+	while (read(sigpipe[0], buf, sizeof buf) > 0)
+		;
+	stats_dump();
+}
@@ -0,0 +1,18 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Runtime statistics, enabled by setting DMENU_STATS to a file name, or to
+ * "-" for stderr. A summary of every histogram is written as JSON lines on
+ * exit and on SIGUSR1. */
+enum { StatKey, StatMatch, StatReadfolder, StatSort, StatDrawmenu, StatDrwMap, /* ms */
+       StatDrwText, StatScanned, StatRejected, StatRequests, StatAlloc,       /* per key */
+       StatLast };
+
+void stats_init(void);
+int stats_fd(void);
+double stats_start(void);
+void stats_time(int stat, double start);
+void stats_count(int stat, unsigned long n);
+void stats_key(void);
+void stats_reset(void);
+void stats_dump(void);
+void stats_signal(void);
@@ -1,19 +1,38 @@
 /* See LICENSE file for copyright and license details. */
 #include <sys/stat.h>
 
+#define __USE_MISC
 #include <dirent.h>
-#include <limits.h>
+#undef __USE_MISC
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "arg.h"
+#include "uring.h"
 char *argv0;
 
 #define FLAG(x)  (flag[(x)-'a'])
+#define BATCH    256 /* statx requests in flight with io_uring */
 
-static void test(const char *, const char *);
+/* a directory read in full so its entries can be stat'ed in one batch */
+struct batch {
+	int dirfd;
+	char **names;
+	unsigned char *types;
+	size_t *entry; /* entry of each stat request */
+	char *pass;
+};
+
+static int needstat(int);
+static struct stat *statfile(int, const char *, int, struct stat *);
+static int check(int, const char *, const char *, int, const struct stat *);
+static void print(const char *);
+static void test(int, const char *, const char *, int);
+static void testdir(DIR *);
 static void usage(void);
 
 static int match = 0;
@@ -21,35 +40,173 @@ static int flag[26];
 static struct stat old, new;
 
 static char before = 0, after = '\n';
+static char outbuf[1 << 16];
+
+/* the type from readdir() answers the file type tests, anything else and
+ * links, which must be followed, need the inode */
+static int
+needstat(int type)
+{
+	return type == DT_UNKNOWN || type == DT_LNK
+	    || FLAG('g') || FLAG('n') || FLAG('o') || FLAG('s') || FLAG('u');
+}
+
+/* returns NULL if the file cannot be stat'ed */
+static struct stat *
+statfile(int dirfd, const char *path, int type, struct stat *st)
+{
+	if (needstat(type))
+		return fstatat(dirfd, path, st, 0) ? NULL : st;
+	st->st_mode = type == DT_BLK ? S_IFBLK : type == DT_CHR ? S_IFCHR :
+	              type == DT_DIR ? S_IFDIR : type == DT_FIFO ? S_IFIFO :
+	              type == DT_REG ? S_IFREG : 0;
+	return st;
+}
+
+/* path is relative to dirfd, type is the d_type from readdir() or DT_UNKNOWN */
+static int
+check(int dirfd, const char *path, const char *name, int type, const struct stat *st)
+{
+	struct stat ln;
+	int mode = 0;
+
+	/* the permission tests are answered by one call */
+	if (FLAG('r')) mode |= R_OK;
+	if (FLAG('w')) mode |= W_OK;
+	if (FLAG('x')) mode |= X_OK;
+
+	return (st                                                    /* exists, -e        */
+	&& (FLAG('a') || name[0] != '.')                              /* hidden files      */
+	&& (!FLAG('b') || S_ISBLK(st->st_mode))                       /* block special     */
+	&& (!FLAG('c') || S_ISCHR(st->st_mode))                       /* character special */
+	&& (!FLAG('d') || S_ISDIR(st->st_mode))                       /* directory         */
+	&& (!FLAG('f') || S_ISREG(st->st_mode))                       /* regular file      */
+	&& (!FLAG('g') || st->st_mode & S_ISGID)                      /* set-group-id flag */
+	&& (!FLAG('h') || (type != DT_UNKNOWN ? type == DT_LNK :      /* symbolic link     */
+	    !fstatat(dirfd, path, &ln, AT_SYMLINK_NOFOLLOW) && S_ISLNK(ln.st_mode)))
+	&& (!FLAG('n') || st->st_mtime > new.st_mtime)                /* newer than file   */
+	&& (!FLAG('o') || st->st_mtime < old.st_mtime)                /* older than file   */
+	&& (!FLAG('p') || S_ISFIFO(st->st_mode))                      /* named pipe        */
+	&& (!FLAG('s') || st->st_size > 0)                            /* not empty         */
+	&& (!FLAG('u') || st->st_mode & S_ISUID)                      /* set-user-id flag  */
+	&& (!mode || faccessat(dirfd, path, mode, 0) == 0)) != FLAG('v'); /* r, w, x   */
+}
+
+static void
+print(const char *name)
+{
+	if (FLAG('q'))
+		exit(0);
+	match = 1;
+	if (before) putchar(before);
+	fputs(name, stdout);
+	if (after) putchar(after);
+}
+
+static void
+test(int dirfd, const char *path, const char *name, int type)
+{
+	struct stat st;
+
+	if (check(dirfd, path, name, type, statfile(dirfd, path, type, &st)))
+		print(name);
+}
+
+/* evaluate the tests for an entry as soon as its statx completes */
+static void
+statdone(unsigned int i, UStat *us, void *arg)
+{
+	struct batch *b = arg;
+	struct stat st, *stp = &st;
+	size_t e = b->entry[i];
+
+	if (us->err == EINVAL || us->err == EOPNOTSUPP) {
+		/* this kernel cannot statx through io_uring */
+		stp = statfile(b->dirfd, b->names[e], DT_UNKNOWN, &st);
+	} else if (us->err) {
+		stp = NULL;
+	} else {
+		st.st_mode = us->mode;
+		st.st_mtime = us->mtime;
+		st.st_size = us->size;
+	}
+	b->pass[e] = check(b->dirfd, b->names[e], b->names[e], b->types[e], stp);
+}
 
+/* test directory contents relative to the directory */
 static void
-test(const char *path, const char *name)
+testdir(DIR *dir)
 {
-	struct stat st, ln;
-
-	if ((!stat(path, &st) && (FLAG('a') || name[0] != '.')        /* hidden files      */
-	&& (!FLAG('b') || S_ISBLK(st.st_mode))                        /* block special     */
-	&& (!FLAG('c') || S_ISCHR(st.st_mode))                        /* character special */
-	&& (!FLAG('d') || S_ISDIR(st.st_mode))                        /* directory         */
-	&& (!FLAG('e') || access(path, F_OK) == 0)                    /* exists            */
-	&& (!FLAG('f') || S_ISREG(st.st_mode))                        /* regular file      */
-	&& (!FLAG('g') || st.st_mode & S_ISGID)                       /* set-group-id flag */
-	&& (!FLAG('h') || (!lstat(path, &ln) && S_ISLNK(ln.st_mode))) /* symbolic link     */
-	&& (!FLAG('n') || st.st_mtime > new.st_mtime)                 /* newer than file   */
-	&& (!FLAG('o') || st.st_mtime < old.st_mtime)                 /* older than file   */
-	&& (!FLAG('p') || S_ISFIFO(st.st_mode))                       /* named pipe        */
-	&& (!FLAG('r') || access(path, R_OK) == 0)                    /* readable          */
-	&& (!FLAG('s') || st.st_size > 0)                             /* not empty         */
-	&& (!FLAG('u') || st.st_mode & S_ISUID)                       /* set-user-id flag  */
-	&& (!FLAG('w') || access(path, W_OK) == 0)                    /* writable          */
-	&& (!FLAG('x') || access(path, X_OK) == 0)) != FLAG('v')) {   /* executable        */
-		if (FLAG('q'))
-			exit(0);
-		match = 1;
-		if (before) putchar(before);
-		fputs(name, stdout);
-		if (after) putchar(after);
+	static Uring *ring;
+	static int tried;
+	struct dirent *d;
+	struct batch b;
+	struct stat st;
+	const char **snames;
+	char *blob = NULL;
+	size_t i, n = 0, ns = 0, len, bloblen = 0, blobsiz = 0, siz = 0, *off = NULL;
+
+	if (!tried) {
+		tried = 1;
+		ring = uring_create(BATCH);
 	}
+	if (!ring) {
+		while ((d = readdir(dir)))
+			test(dirfd(dir), d->d_name, d->d_name, d->d_type);
+		return;
+	}
+
+	/* read the whole directory, then stat what needs it in batches, the
+	 * output keeps the readdir() order */
+	b.dirfd = dirfd(dir);
+	b.types = NULL;
+	while ((d = readdir(dir))) {
+		len = strlen(d->d_name) + 1;
+		if (bloblen + len > blobsiz) {
+			blobsiz = bloblen + len + 65536;
+			if (!(blob = realloc(blob, blobsiz)))
+				exit(2);
+		}
+		if (n == siz) {
+			siz = siz ? siz * 2 : 1024;
+			if (!(off = realloc(off, siz * sizeof(*off))) ||
+			    !(b.types = realloc(b.types, siz)))
+				exit(2);
+		}
+		memcpy(blob + bloblen, d->d_name, len);
+		off[n] = bloblen;
+		b.types[n++] = d->d_type;
+		bloblen += len;
+	}
+	if (!(b.names = calloc(n + 1, sizeof(*b.names))) ||
+	    !(snames = calloc(n + 1, sizeof(*snames))) ||
+	    !(b.entry = calloc(n + 1, sizeof(*b.entry))) ||
+	    !(b.pass = calloc(n + 1, 1)))
+		exit(2);
+	for (i = 0; i < n; i++) {
+		b.names[i] = blob + off[i];
+		if (needstat(b.types[i])) {
+			b.entry[ns] = i;
+			snames[ns++] = b.names[i];
+		} else {
+			b.pass[i] = check(b.dirfd, b.names[i], b.names[i], b.types[i],
+			                  statfile(b.dirfd, b.names[i], b.types[i], &st));
+		}
+	}
+	uring_stat(ring, b.dirfd, snames, ns, 1,
+	           (FLAG('n') || FLAG('o') ? UringMtime : 0) | (FLAG('s') ? UringSize : 0),
+	           statdone, &b);
+	for (i = 0; i < n; i++)
+		if (b.pass[i])
+			print(b.names[i]);
+
+	free(blob);
+	free(off);
+	free(b.types);
+	free(b.names);
+	free(snames);
+	free(b.entry);
+	free(b.pass);
 }
 
 static void
@@ -64,12 +221,10 @@ usage(void)
 int
 main(int argc, char *argv[])
 {
-	struct dirent *d;
-	char path[PATH_MAX], *line = NULL, *file;
+	char *line = NULL, *file;
 	size_t linesiz = 0;
 	ssize_t n;
 	DIR *dir;
-	int r;
 
 	ARGBEGIN {
 	case 'n': /* newer than file */
@@ -92,27 +247,24 @@ main(int argc, char *argv[])
 			usage(); /* unknown flag */
 	} ARGEND;
 
+	/* names are written in large blocks rather than line by line */
+	setvbuf(stdout, outbuf, _IOFBF, sizeof outbuf);
+
 	if (!argc) {
 		/* read list from stdin */
 		while ((n = getline(&line, &linesiz, stdin)) > 0) {
 			if (line[n - 1] == '\n')
 				line[n - 1] = '\0';
-			test(line, line);
+			test(AT_FDCWD, line, line, DT_UNKNOWN);
 		}
 		free(line);
 	} else {
 		for (; argc; argc--, argv++) {
 			if (FLAG('l') && (dir = opendir(*argv))) {
-				/* test directory contents */
-				while ((d = readdir(dir))) {
-					r = snprintf(path, sizeof path, "%s/%s",
-					             *argv, d->d_name);
-					if (r >= 0 && (size_t)r < sizeof path)
-						test(path, d->d_name);
-				}
+				testdir(dir);
 				closedir(dir);
 			} else {
-				test(*argv, *argv);
+				test(AT_FDCWD, *argv, *argv, DT_UNKNOWN);
 			}
 		}
 	}
@@ -0,0 +1,55 @@
+/* See LICENSE file for copyright and license details. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timing.h"
+
+static FILE *fp;
+static double origin;
+
+double timing_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void timing_init(void) {
+	const char *dest = getenv("DMENU_TIMING");
+
+	origin = timing_now();
+	if (!dest)
+		return;
+	if (!*dest || !strcmp(dest, "-"))
+		fp = stderr;
+	else if (!(fp = fopen(dest, "a")))
+		perror(dest);
+}
+
+int timing_enabled(void) {
+	return fp != NULL;
+}
+
+/* start and ms are milliseconds, start relative to timing_init() */
+void timing_phase(const char *name, double start) {
+	if (!fp)
+		return;
+	fprintf(fp, "{\"pid\":%ld,\"phase\":\"%s\",\"start\":%.3f,\"ms\":%.3f}\n",
+	        (long)getpid(), name, start - origin, timing_now() - start);
+	fflush(fp);
+}
+
+void timing_mark(const char *name) {
+	timing_phase(name, timing_now());
+}
+
+void timing_value(const char *name, long value) {
+	if (!fp)
+		return;
+	fprintf(fp, "{\"pid\":%ld,\"value\":\"%s\",\"start\":%.3f,\"n\":%ld}\n",
+	        (long)getpid(), name, timing_now() - origin, value);
+	fflush(fp);
+}
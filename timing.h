@@ -0,0 +1,10 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Startup timing, enabled by setting DMENU_TIMING to a file name, or to
+ * "-" for stderr. Every record is one JSON object per line. */
+void timing_init(void);
+int timing_enabled(void);
+double timing_now(void);
+void timing_phase(const char *name, double start);
+void timing_mark(const char *name);
+void timing_value(const char *name, long value);
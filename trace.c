@@ -0,0 +1,104 @@
+/* See LICENSE file for copyright and license details. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "timing.h"
+#include "trace.h"
+#include "util.h"
+
+#define EVENTS  65536 /* a power of two, the oldest spans are overwritten */
+#define THREADS 16
+
+typedef struct {
+	const char *name; /* a string literal, it is not copied */
+	double start, dur; /* ms */
+	long arg;
+	pthread_t thread;
+} Event;
+
+static Event *ring;
+static unsigned long nevents; /* ever recorded, the ring holds the last */
+static const char *dest;
+static pthread_t mainthread;
+
+void trace_init(void) {
+	if (!(dest = getenv("DMENU_TRACE")) || !*dest)
+		return;
+	ring = ecalloc(EVENTS, sizeof(*ring));
+	mainthread = pthread_self();
+}
+
+/* the start of a span, 0 if nothing is traced */
+double trace_begin(void) {
+	return ring ? timing_now() : 0;
+}
+
+/* a span from start, as returned by trace_begin() or timing_now(), to now;
+ * arg, if not negative, is shown with it */
+void trace_arg(const char *name, double start, long arg) {
+	Event *e;
+
+	if (!ring)
+		return;
+	e = &ring[__atomic_fetch_add(&nevents, 1, __ATOMIC_RELAXED) & (EVENTS - 1)];
+	e->name = name;
+	e->start = start;
+	e->dur = timing_now() - start;
+	e->arg = arg;
+	e->thread = pthread_self();
+}
+
+void trace_end(const char *name, double start) {
+	trace_arg(name, start, -1);
+}
+
+/* small thread ids in order of appearance, the main thread is 1 */
+static int tid(pthread_t *threads, int *n, pthread_t thread) {
+	int i;
+
+	for (i = 0; i < *n; i++)
+		if (pthread_equal(threads[i], thread))
+			return i + 1;
+	if (*n == THREADS)
+		return THREADS + 1;
+	threads[(*n)++] = thread;
+	return *n;
+}
+
+void trace_dump(void) {
+	pthread_t threads[THREADS];
+	unsigned long i, first, last;
+	long pid = (long)getpid();
+	int t, n = 0;
+	FILE *fp;
+	Event *e;
+
+	if (!ring)
+		return;
+	if (!(fp = fopen(dest, "w"))) {
+		perror(dest);
+		return;
+	}
+	last = __atomic_load_n(&nevents, __ATOMIC_RELAXED);
+	first = last > EVENTS ? last - EVENTS : 0;
+	tid(threads, &n, mainthread);
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+	        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"dmenu\"}}",
+	        pid);
+	for (i = first; i < last; i++) {
+		e = &ring[i & (EVENTS - 1)];
+		fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%d,"
+		        "\"ts\":%.3f,\"dur\":%.3f", e->name, pid,
+		        tid(threads, &n, e->thread), e->start * 1e3, e->dur * 1e3);
+		if (e->arg >= 0)
+			fprintf(fp, ",\"args\":{\"n\":%ld}", e->arg);
+		fputc('}', fp);
+	}
+	for (t = 1; t <= n; t++)
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,"
+		        "\"args\":{\"name\":\"%s\"}}", pid, t, t == 1 ? "main" : "worker");
+	fputs("\n]}\n", fp);
+	fclose(fp);
+}
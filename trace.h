@@ -0,0 +1,11 @@
+/* See LICENSE file for copyright and license details. */
+
+/* Chrome trace events, enabled by setting DMENU_TRACE to a file name. Spans
+ * are kept in a ring buffer allocated up front, so recording one takes a
+ * clock read and a few stores; the file, for ui.perfetto.dev or
+ * chrome://tracing, is written on exit. */
+void trace_init(void);
+double trace_begin(void);
+void trace_end(const char *name, double start);
+void trace_arg(const char *name, double start, long arg);
+void trace_dump(void);
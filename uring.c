@@ -0,0 +1,155 @@
+/* See LICENSE file for copyright and license details. */
+#ifdef IOURING
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+#include "uring.h"
+#include "util.h"
+
+struct Uring {
+	int fd;
+	unsigned int entries;
+	unsigned int *sqhead, *sqtail, *sqmask, *sqarray;
+	unsigned int *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	struct statx *stx;
+	void *sq, *cq;
+	size_t sqsz, cqsz;
+};
+
+Uring *uring_create(unsigned int entries) {
+	struct io_uring_params p;
+	Uring *ring;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	if ((fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return NULL;
+
+	ring = ecalloc(1, sizeof(*ring));
+	ring->fd = fd;
+	ring->entries = p.sq_entries;
+	ring->sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sqsz = ring->cqsz = MAX(ring->sqsz, ring->cqsz);
+	ring->sq = mmap(NULL, ring->sqsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq = ring->sq;
+	else
+		ring->cq = mmap(NULL, ring->cqsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+	if (ring->sq == MAP_FAILED || ring->cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		uring_free(ring);
+		return NULL;
+	}
+
+	ring->sqhead = (unsigned int *)((char *)ring->sq + p.sq_off.head);
+	ring->sqtail = (unsigned int *)((char *)ring->sq + p.sq_off.tail);
+	ring->sqmask = (unsigned int *)((char *)ring->sq + p.sq_off.ring_mask);
+	ring->sqarray = (unsigned int *)((char *)ring->sq + p.sq_off.array);
+	ring->cqhead = (unsigned int *)((char *)ring->cq + p.cq_off.head);
+	ring->cqtail = (unsigned int *)((char *)ring->cq + p.cq_off.tail);
+	ring->cqmask = (unsigned int *)((char *)ring->cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq + p.cq_off.cqes);
+	ring->stx = ecalloc(ring->entries, sizeof(*ring->stx));
+
+	return ring;
+}
+
+void uring_free(Uring *ring) {
+	if (!ring)
+		return;
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+	if (ring->cq && ring->cq != MAP_FAILED && ring->cq != ring->sq)
+		munmap(ring->cq, ring->cqsz);
+	if (ring->sq && ring->sq != MAP_FAILED)
+		munmap(ring->sq, ring->sqsz);
+	close(ring->fd);
+	free(ring->stx);
+	free(ring);
+}
+
+void uring_stat(Uring *ring, int dirfd, const char *const *names, unsigned int n,
+                int follow, unsigned int mask, void (*done)(unsigned int, UStat *, void *), void *arg) {
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct statx *stx;
+	UStat us;
+	unsigned int i, j, batch, head, tail, want, reaped;
+
+	want = STATX_TYPE | STATX_MODE;
+	if (mask & UringMtime)
+		want |= STATX_MTIME;
+	if (mask & UringSize)
+		want |= STATX_SIZE;
+
+	for (i = 0; i < n; i += batch) {
+		batch = MIN(n - i, ring->entries);
+
+		/* queue the whole batch, then submit it with one syscall */
+		tail = *ring->sqtail;
+		for (j = 0; j < batch; j++, tail++) {
+			sqe = &ring->sqes[tail & *ring->sqmask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dirfd;
+			sqe->addr = (uintptr_t)names[i + j];
+			sqe->len = want;
+			sqe->off = (uintptr_t)&ring->stx[j];
+			sqe->statx_flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+			sqe->user_data = j;
+			ring->sqarray[tail & *ring->sqmask] = tail & *ring->sqmask;
+		}
+		__atomic_store_n(ring->sqtail, tail, __ATOMIC_RELEASE);
+
+		/* hand each result over as soon as it completes */
+		for (reaped = 0; reaped < batch; ) {
+			if (syscall(__NR_io_uring_enter, ring->fd, reaped ? 0 : batch,
+			            1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+				die("io_uring_enter:");
+			head = *ring->cqhead;
+			tail = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE);
+			for (; head != tail; head++, reaped++) {
+				cqe = &ring->cqes[head & *ring->cqmask];
+				j = cqe->user_data;
+				stx = &ring->stx[j];
+				us.err = cqe->res < 0 ? -cqe->res : 0;
+				us.mode = stx->stx_mode;
+				us.mtime = stx->stx_mtime.tv_sec;
+				us.size = stx->stx_size;
+				done(i + j, &us, arg);
+			}
+			__atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+		}
+	}
+}
+#else
+#include <stddef.h>
+
+#include "uring.h"
+
+Uring *uring_create(unsigned int entries) {
+	return NULL;
+}
+
+void uring_free(Uring *ring) {
+}
+
+void uring_stat(Uring *ring, int dirfd, const char *const *names, unsigned int n,
+                int follow, unsigned int mask, void (*done)(unsigned int, UStat *, void *), void *arg) {
+}
+#endif
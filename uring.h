@@ -0,0 +1,21 @@
+/* See LICENSE file for copyright and license details. */
+
+/* what uring_stat() found out about a file */
+typedef struct {
+	int err;            /* 0 or the errno of the failed statx */
+	unsigned int mode;
+	long long mtime;
+	long long size;
+} UStat;
+
+enum { UringMtime = 1 << 0, UringSize = 1 << 1 }; /* uring_stat() mask */
+
+typedef struct Uring Uring;
+
+/* Batched stat through io_uring, uring_create() returns NULL if it is not
+ * available and the caller has to stat synchronously. */
+Uring *uring_create(unsigned int entries);
+void uring_free(Uring *ring);
+/* stat names[0..n) relative to dirfd, calling done for each as it completes */
+void uring_stat(Uring *ring, int dirfd, const char *const *names, unsigned int n,
+                int follow, unsigned int mask, void (*done)(unsigned int, UStat *, void *), void *arg);